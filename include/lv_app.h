@@ -67,6 +67,12 @@ struct Bottom_Grid_Buttons {
   lv_obj_t *settings;
 };
 
+// Raw touch readings and the screen points they were taken at
+struct Touch_Calibration_Points {
+  uint16_t raw[3][2];
+  uint16_t screen[3][2];
+};
+
 struct Big_Labels_Value {
   float v;
   float a;
@@ -130,8 +136,9 @@ class LVGL_App {
 
  public:
   void app_entry();
+  // version changes whenever any of the values was published, the same version as last time skips the update
   void app_update(const Big_Labels_Value &big_labels_value, const Setting_Labels_Value &setting_labels_value,
-                  const Status_Labels_Value &status_labels_value);
+                  const Status_Labels_Value &status_labels_value, uint32_t version);
 
   void set_setting_highlight(Setting_Highlighted_Container container, bool highlight);
   void set_source_highlight(Sensed_Source container, bool highlight);
@@ -141,6 +148,19 @@ class LVGL_App {
 
   void attach_internal_changes_cb(std::function<void(EventData *)> internal_changes_cb) { this->internal_changes_cb = internal_changes_cb; }
   void attach_wifi_cb(std::function<void(EventData *)> wifi_cb) { this->wifi_cb = wifi_cb; }
+  // Called with the new state when a tap on the measurement column toggles the trend view
+  void attach_trend_view_cb(std::function<void(bool)> trend_view_cb) { this->trend_view_cb = trend_view_cb; }
+  // Called on a long press of the top bar, meant for a service screen
+  void attach_diagnostics_cb(std::function<void()> diagnostics_cb) { this->diagnostics_cb = diagnostics_cb; }
+  // The calibration wizard reads the pen with touch_raw_cb (false while released) and hands the three points to touch_calibrated_cb,
+  // which returns false when they don't give a usable map
+  void attach_touch_calibration_cb(std::function<bool(uint16_t &, uint16_t &)>           touch_raw_cb,
+                                   std::function<bool(const Touch_Calibration_Points &)> touch_calibrated_cb) {
+    this->touch_raw_cb        = touch_raw_cb;
+    this->touch_calibrated_cb = touch_calibrated_cb;
+  }
+  // Full screen three point touch calibration, returns to the current screen when done
+  void touch_calibration_screen();
 
   lv_obj_t *modal_create_alert(const char *message, const char *headerText = "Informasi!", const lv_font_t *headerFont = &lv_font_montserrat_20,
                                const lv_font_t *messageFont = &lv_font_montserrat_14, lv_color_t headerTextColor = bs_white,
@@ -161,6 +181,9 @@ class LVGL_App {
                                  const char *cancelButtonText = "Batal", lv_coord_t xSize = lv_pct(70), lv_coord_t ySize = lv_pct(70));
 
   void set_wifi_status(bool connected);
+  // Hides the measurement column while lvgl_trend_view_*() draws over it, so its labels stop invalidating the area
+  void set_trend_view(bool on);
+  bool is_trend_view() { return trend_view; }
 
   Bottom_Grid_Buttons &get_bottom_grid_buttons() { return bottom_grid_buttons; }
 
@@ -173,6 +196,8 @@ class LVGL_App {
   std::vector<std::string> wifi_list;
   std::string              connected_wifi;
   bool                     is_wifi_connected = false;
+  lv_obj_t                *trend_area        = nullptr;
+  bool                     trend_view        = false;
 
   Keyboards                     keyboards;
   Setting_Highlighted_Container setting_highlight;
@@ -184,6 +209,12 @@ class LVGL_App {
   Bottom_Grid_Buttons              bottom_grid_buttons;
   std::function<void(EventData *)> internal_changes_cb = nullptr;
   std::function<void(EventData *)> wifi_cb             = nullptr;
+  std::function<void(bool)>        trend_view_cb       = nullptr;
+  std::function<void()>            diagnostics_cb      = nullptr;
+
+  // Touch calibration wizard
+  std::function<bool(uint16_t &, uint16_t &)>           touch_raw_cb        = nullptr;
+  std::function<bool(const Touch_Calibration_Points &)> touch_calibrated_cb = nullptr;
 
   static constexpr uint32_t anim_time          = 500;
   static constexpr uint32_t anim_translation_y = 150;
@@ -8,4 +8,106 @@
 
 extern void init_display();
 void lvgl_display_init();
+
+// Time spent on each side of the flush pipeline since the last reset.
+// render_us and spi_us overlap when both stripe buffers are in use, wait_us
+// is rendering blocked on a buffer still going out over SPI.
+struct lvgl_flush_stats_t {
+  uint32_t flushes;
+  uint32_t pixels;
+  uint32_t render_us;
+  uint32_t setup_us; // set_address_window before each DMA
+  uint32_t spi_us;
+  uint32_t wait_us;
+};
+
+void lvgl_display_get_flush_stats(lvgl_flush_stats_t &stats);
+void lvgl_display_reset_flush_stats();
+void lvgl_display_print_flush_stats();
+
+// Frame pacing: LVGL renders once per frame slot instead of whenever its
+// refresh timer fires. Slots are a whole number of panel refreshes, timed
+// from the TE pin when it is wired, else from the nominal panel rate.
+// Runs lv_timer_handler() and returns the us core1 may sleep.
+uint32_t lvgl_frame_pace();
+void lvgl_frame_pacing_set_fps(uint32_t fps);
+
+struct lvgl_frame_stats_t {
+  uint32_t frames;   // Slots that had something to draw
+  uint32_t skipped;  // Slots missed because a frame ran over
+  uint32_t frame_us; // Render and flush time of all frames
+  uint32_t frame_max_us;
+  uint32_t coalesced; // Frames whose dirty areas were merged into one
+  uint32_t te_edges;
+};
+
+void lvgl_frame_get_stats(lvgl_frame_stats_t &stats);
+void lvgl_frame_reset_stats();
+void lvgl_frame_print_stats();
+
+// 1 records per frame histograms of the display pipeline, shown by
+// lvgl_profiler_show() and printed by lvgl_profiler_request_dump(). 0 leaves
+// no code behind in the flush path.
+#ifndef LVGL_PROFILER
+#define LVGL_PROFILER 0
+#endif
+
+#if LVGL_PROFILER == 1
+enum lvgl_profiler_metric_t {
+  PROF_TIMERS_US,  // lv_timer_handler(), input and animations
+  PROF_RENDER_US,  // Rendering of all stripes of a frame
+  PROF_DMA_WAIT_US, // Rendering stalled on the other stripe's DMA
+  PROF_FLUSH_BYTES, // Bytes sent to the panel per frame
+  PROF_DIRTY_AREAS, // Areas drawn per frame after coalescing
+  PROF_HEAP_USED,   // LVGL heap in use, sampled once a second
+  PROF_METRIC_COUNT
+};
+
+// Bin 0 holds zeros, bin n values in [2^(n-1), 2^n)
+#define LVGL_HISTOGRAM_BINS 20
+
+struct lvgl_histogram_t {
+  uint32_t bins[LVGL_HISTOGRAM_BINS];
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+};
+
+void lvgl_profiler_get(lvgl_profiler_metric_t metric, lvgl_histogram_t &hist);
+void lvgl_profiler_reset();
+// Loads the diagnostics screen, a tap returns to the previous one
+void lvgl_profiler_show();
+// Safe from core0, the dump is printed by the next lvgl_frame_pace()
+void lvgl_profiler_request_dump();
+#endif
+
+// Trend view: the left TREND_VIEW_WIDTH columns become a V/A/W chart in the
+// panel's vertical scroll area. A sample writes one 320 px column and moves
+// the scroll start, LVGL keeps drawing the rest of the screen. LANDSCAPE only.
+#define TREND_VIEW_WIDTH 240
+
+struct trend_sample_t {
+  float v;
+  float a;
+  float w;
+};
+
+// history holds the last count samples, oldest first, the last
+// TREND_VIEW_WIDTH of them fill the chart
+bool lvgl_trend_view_begin(const trend_sample_t *history, size_t count);
+void lvgl_trend_view_push(const trend_sample_t &sample);
+void lvgl_trend_view_end();
+bool lvgl_trend_view_active();
+// LVGL wanted to redraw the whole width (screen change, overlay), the view
+// should end so it becomes visible
+bool lvgl_trend_view_covered();
+
+// Touch calibration: the affine map of the XPT2046 is kept in the last flash
+// sector and loaded by lvgl_display_init(), the bounds defaults apply until
+// one is stored.
+bool lvgl_touch_get_raw(uint16_t &x, uint16_t &y);
+// Solves the map from three raw readings and the screen points they were
+// taken at, applies and stores it. False keeps the current map.
+bool lvgl_touch_calibrate(const uint16_t raw[3][2], const uint16_t screen[3][2]);
+bool lvgl_touch_is_calibrated();
 #endif
\ No newline at end of file
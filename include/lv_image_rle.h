@@ -0,0 +1,11 @@
+#ifndef _LV_IMAGE_RLE_H
+#define _LV_IMAGE_RLE_H
+#include "lvgl.h"
+
+// Image decoder for RGB565 images compressed by tools/image_rle.cpp, marked
+// with LV_IMAGE_FLAGS_USER1. Rows are decoded a few at a time straight into
+// the stripe being rendered, the whole image is never held in RAM. Call after
+// lv_init().
+void lv_image_rle_init();
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _SEQLOCK_H
+#define _SEQLOCK_H
+
+#include <stdint.h>
+
+#include "hardware/sync.h"
+
+// A value published by one writer and read by any number of readers on either core, without a lock. The writer fills the slot readers
+// are not on and then bumps the sequence, so it never waits. A reader copies the current slot and retries only if the writer moved on
+// during the copy, which a reader interrupting the writer on its own core never sees, so it can't spin. The sequence doubles as the
+// version, it changes exactly once per publish().
+template <typename T>
+class Seqlock {
+ public:
+  // Single writer only
+  void publish(const T &value) {
+    uint32_t s        = seq;
+    slot[(s + 1) & 1] = value;
+    __dmb();  // Publish the slot before the new sequence
+    seq = s + 1;
+  }
+
+  T load(uint32_t *version = nullptr) const {
+    T        value;
+    uint32_t s;
+    do {
+      s = seq;
+      __dmb();
+      value = slot[s & 1];
+      __dmb();
+    } while (seq != s);
+    if (version)
+      *version = s;
+    return value;
+  }
+
+  uint32_t version() const { return seq; }
+
+ private:
+  T                 slot[2] = {};
+  volatile uint32_t seq     = 0;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/sync.h"
+
+// Bounded FIFO for one producer and one consumer, which may be an IRQ and a loop or the two cores, without a lock. Both sides are O(1)
+// and never wait, a push to a full queue fails and is counted in dropped().
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  // Producer only
+  bool push(const T &item) {
+    uint32_t h = head;
+    if (h - tail == N) {
+      drops++;
+      return false;
+    }
+    buf[h % N] = item;
+    __dmb();  // Publish the slot before the new head
+    head = h + 1;
+    return true;
+  }
+
+  // Consumer only
+  bool pop(T &item) {
+    uint32_t t = tail;
+    if (t == head)
+      return false;
+    __dmb();  // Don't read the slot before seeing the head that published it
+    item = buf[t % N];
+    __dmb();  // Finish reading the slot before handing it back
+    tail = t + 1;
+    return true;
+  }
+
+  bool     empty() const { return head == tail; }
+  uint32_t dropped() const { return drops; }
+
+ private:
+  T                 buf[N];
+  volatile uint32_t head  = 0;
+  volatile uint32_t tail  = 0;
+  volatile uint32_t drops = 0;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _TREND_BUFFER_H
+#define _TREND_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/sync.h"
+
+// Fixed size ring of the last N samples, written by one core and read by the other without a lock. The writer never waits, a reader
+// that falls more than N - margin samples behind skips the oldest ones instead of reading slots being overwritten.
+template <typename T, size_t N>
+class TrendBuffer {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  // Single writer only
+  void push(const T &sample) {
+    uint32_t h     = head;
+    buf[h % N]     = sample;
+    __dmb();  // Publish the slot before the new head
+    head = h + 1;
+  }
+
+  // Number of samples pushed so far, also the cursor of the next one
+  uint32_t count() const { return head; }
+
+  // Copies up to max samples from cursor on and advances it, returns how many were copied
+  size_t read(uint32_t &cursor, T *out, size_t max) const {
+    uint32_t h = head;
+    __dmb();
+    if (h - cursor > N - margin)
+      cursor = h - (N - margin);
+    size_t n = 0;
+    while (cursor != h && n < max)
+      out[n++] = buf[cursor++ % N];
+    return n;
+  }
+
+ private:
+  static constexpr uint32_t margin = 4;  // Slots the writer may fill while a read is running
+  T                         buf[N];
+  volatile uint32_t         head = 0;
+};
+
+#endif
@@ -1,11 +1,13 @@
 #include "click_encoder.h"
 
-const int8_t ClickEncoder::encoder_table[16] = {0, 0, -1, 0, 0, 0,  0, 1,
-                                               1, 0, 0,  0, 0, -1, 0, 0};
+ClickEncoder *ClickEncoder::instances[2] = {nullptr, nullptr};
+
+// Acceleration decays by (accel_dec + 5) every period of the old 100 us poll
+#define ACCEL_DECAY_US 100
 
 ClickEncoder::ClickEncoder(uint8_t A, uint8_t B, uint8_t BTN,
                            uint8_t stepsPerNotch, bool active)
-    : pin_a(A), pin_b(B), pin_btn(BTN), pins_active(active), delta(0), last(0),
+    : pin_a(A), pin_b(B), pin_btn(BTN), pins_active(active), position(0), last(0),
       steps(stepsPerNotch), acceleration(0), acceleration_enabled(false),
       button(Open) {}
 
@@ -30,56 +32,90 @@ void ClickEncoder::init() {
   }
 
   // Initial state
-  last = (gpio_get(pin_a) == pins_active) ? 3 : 0;
+  last = (gpio_get(pin_a) == pins_active) ? 2 : 0;
   last |= (gpio_get(pin_b) == pins_active) ? 1 : 0;
+  last_edge_us = time_us_32();
+
+  if (pin_a == 0xFF || pin_b == 0xFF)
+    return;
+  for (auto &slot : instances) {
+    if (slot == nullptr || slot == this) {
+      slot = this;
+      break;
+    }
+  }
+  // Raw handlers so other pins of the bank keep their own callbacks
+  gpio_add_raw_irq_handler(pin_a, gpio_irq_handler);
+  gpio_add_raw_irq_handler(pin_b, gpio_irq_handler);
+  gpio_set_irq_enabled(pin_a, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+  gpio_set_irq_enabled(pin_b, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+  irq_set_enabled(IO_IRQ_BANK0, true);
 }
 
-void ClickEncoder::service() {
-  // Encoder handling
-  bool moved = false;
-
-  if (pin_a >= 0 && pin_b >= 0) {
-    if (acceleration_enabled) { // decelerate every tick
-      acceleration -= accel_dec;
-      if(acceleration < 0)
-        acceleration = 0;
-    }
-    int8_t curr = 0;
+void __isr ClickEncoder::gpio_irq_handler() {
+  const uint32_t edges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+  for (ClickEncoder *enc : instances) {
+    if (enc == nullptr)
+      continue;
+    bool a = gpio_get_irq_event_mask(enc->pin_a) & edges;
+    bool b = gpio_get_irq_event_mask(enc->pin_b) & edges;
+    if (!a && !b)
+      continue;
+    if (a)
+      gpio_acknowledge_irq(enc->pin_a, edges);
+    if (b)
+      gpio_acknowledge_irq(enc->pin_b, edges);
+    enc->edge();
+  }
+}
 
-    // Read current state of pins
-    if (gpio_get(pin_a) == pins_active) {
-      curr |= 2; // Set bit 1 (A pin)
-    }
-    if (gpio_get(pin_b) == pins_active) {
-      curr |= 1; // Set bit 0 (B pin)
-    }
+int32_t ClickEncoder::decayed_acceleration(int32_t accel, uint32_t elapsed_us) {
+  uint32_t periods = elapsed_us / ACCEL_DECAY_US;
+  uint32_t decay = (acceleration_enabled ? accel_dec : 0) + 5;
+  if (periods == 0)
+    return accel;
+  if (periods >= (uint32_t)accel / decay + 1)
+    return 0;
+  return accel - (int32_t)(periods * decay);
+}
 
-    // State transition table for quadrature decoding
-    // Each mechanical step corresponds to a full cycle of 4 states
-    // The table maps (last << 2 | curr) to delta change
-    static const int8_t transitionTable[16] = {
-        0,  -1, 1,  0,  // Previous state 0b00
-        1,  0,  0,  -1, // Previous state 0b01
-        -1, 0,  0,  1,  // Previous state 0b10
-        0,  1,  -1, 0   // Previous state 0b11
-    };
-
-    // Calculate the transition index
-    int8_t transition = transitionTable[(last << 2) | curr];
-
-    // If a valid transition occurred, update delta and state
-    if (transition != 0) {
-      delta += transition; // Add ±1 per mechanical step
-      last = curr;         // Update the last state
-      moved = true;        // Flag that movement occurred
-
-      // Handle acceleration if enabled
-      if (acceleration_enabled && acceleration <= (accel_top - accel_inc)) {
-        acceleration += accel_inc;
-      }
-    }
+// One A or B edge, the pins are read again as the other one may have bounced
+// meanwhile
+void ClickEncoder::edge() {
+  int8_t curr = 0;
+  if (gpio_get(pin_a) == pins_active) {
+    curr |= 2; // Set bit 1 (A pin)
+  }
+  if (gpio_get(pin_b) == pins_active) {
+    curr |= 1; // Set bit 0 (B pin)
   }
 
+  // State transition table for quadrature decoding
+  // Each mechanical step corresponds to a full cycle of 4 states
+  // The table maps (last << 2 | curr) to delta change
+  static const int8_t transitionTable[16] = {
+      0,  -1, 1,  0,  // Previous state 0b00
+      1,  0,  0,  -1, // Previous state 0b01
+      -1, 0,  0,  1,  // Previous state 0b10
+      0,  1,  -1, 0   // Previous state 0b11
+  };
+
+  int8_t transition = transitionTable[(last << 2) | curr];
+  if (transition == 0)
+    return;
+  position += transition; // Add ±1 per mechanical step
+  last = curr;
+
+  uint32_t now = time_us_32();
+  int32_t accel = decayed_acceleration(acceleration, now - last_edge_us);
+  last_edge_us = now;
+  if (acceleration_enabled && accel <= (accel_top - accel_inc)) {
+    accel += accel_inc;
+  }
+  acceleration = accel;
+}
+
+void ClickEncoder::service() {
   // Button handling
   if (pin_btn != 0xFF) {
     absolute_time_t now = get_absolute_time();
@@ -91,7 +127,7 @@ void ClickEncoder::service() {
 
       if (btnState) {
         keydown_ticks++;
-        if (keydown_ticks > (button_hold_time / 10) && button_held_enabled) {
+        if (keydown_ticks > (button_hold_time / ENC_SERVICE_MS) && button_held_enabled) {
           button = Held;
         }
       } else {
@@ -101,11 +137,11 @@ void ClickEncoder::service() {
             doubleclick_ticks = 0;
           } else {
             if (doubleclick_ticks > 0 &&
-                doubleclick_ticks < (button_double_click_time / 10)) {
+                doubleclick_ticks < (button_double_click_time / ENC_SERVICE_MS)) {
               button = DoubleClicked;
               doubleclick_ticks = 0;
             } else {
-              doubleclick_ticks = button_double_click_time / 10;
+              doubleclick_ticks = button_double_click_time / ENC_SERVICE_MS;
             }
           }
         }
@@ -120,21 +156,19 @@ void ClickEncoder::service() {
       }
     }
   }
-
-  // Decay acceleration
-  if (acceleration > 5)
-    acceleration -= 5;
-  else
-    acceleration = 0;
 }
 
 int16_t ClickEncoder::get_value() {
-  int16_t val = delta;
-  delta = 0;
+  // Only the edge interrupt writes position, which may run on the other core
+  int32_t pos = position;
+  int16_t val = pos - position_read;
+  position_read = pos;
+  int32_t accel =
+      decayed_acceleration(acceleration, time_us_32() - last_edge_us);
 
   // Apply acceleration
   if (acceleration_enabled) {
-    val *= 1 + (acceleration >> 4);
+    val *= 1 + (accel >> 4);
   }
 
   return val;
@@ -4,9 +4,12 @@
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/timer.h"
+#include "hardware/irq.h"
 
 #define BTN_DOUBLECLICKTIME  400
 #define BTN_HOLDTIME        1000
+// Period service() is expected at, the button timings count in these ticks
+#define ENC_SERVICE_MS        10
 
 // Encoder types
 #define ENC_NORMAL        (1 << 1)
@@ -31,7 +34,9 @@ public:
     ClickEncoder(uint8_t pinA, uint8_t pinB, uint8_t pinBTN = 0xFF, 
                 uint8_t stepsPerNotch = 1, bool active = 0);
     
+    // Counts A/B edges from the GPIO interrupt of the calling core
     void init();
+    // Button debounce and click timing, call every ENC_SERVICE_MS
     void service(void);
     int16_t get_value(void);
 
@@ -51,10 +56,15 @@ public:
 private:
     uint8_t pin_a, pin_b, pin_btn;
     bool pins_active;
-    int32_t delta;
+    // Steps counted by edge() and the part of them get_value() returned
+    volatile int32_t position;
+    int32_t position_read = 0;
     int32_t last;
     uint16_t steps;
-    int32_t acceleration;
+    // Built up by edges and decayed by the time between them, the decay since
+    // the last edge is applied in get_value()
+    volatile int32_t acceleration;
+    volatile uint32_t last_edge_us = 0;
     bool acceleration_enabled;
 
     // Button state
@@ -73,6 +83,8 @@ private:
 
     int debounce_time = 5;
 
-    bool get_pin_state();
-    static const int8_t encoder_table[16];
+    int32_t decayed_acceleration(int32_t accel, uint32_t elapsed_us);
+    void edge();
+    static void gpio_irq_handler();
+    static ClickEncoder *instances[2];
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "dma_manager.h"
+
+#include "hardware/irq.h"
+
+struct dma_client_t {
+  dma_complete_cb_t cb;
+  void *user_data;
+  uint irq_index;
+};
+
+static dma_client_t clients[NUM_DMA_CHANNELS];
+// Channels with a callback per IRQ line, other pending bits are left to
+// whoever else shares the line
+static volatile uint32_t irq_channels[2];
+static bool handler_added[2];
+
+static void dma_irq_dispatch(uint irq_index) {
+  volatile uint32_t &ints = irq_index ? dma_hw->ints1 : dma_hw->ints0;
+  uint32_t pending = ints & irq_channels[irq_index];
+  // Acknowledge first, a callback may restart its channel
+  ints = pending;
+  while (pending) {
+    uint channel = __builtin_ctz(pending);
+    pending &= pending - 1;
+    clients[channel].cb(channel, clients[channel].user_data);
+  }
+}
+
+static void __isr dma_irq0_handler() { dma_irq_dispatch(0); }
+static void __isr dma_irq1_handler() { dma_irq_dispatch(1); }
+
+int dma_manager_claim(bool required, dma_complete_cb_t cb, void *user_data) {
+  int channel = dma_claim_unused_channel(required);
+  if (channel < 0 || !cb)
+    return channel;
+
+  // Each core only touches its own line, no lock needed
+  uint irq_index = get_core_num();
+  uint irq_num = irq_index ? DMA_IRQ_1 : DMA_IRQ_0;
+  clients[channel] = {cb, user_data, irq_index};
+  irq_channels[irq_index] |= 1u << channel;
+  if (!handler_added[irq_index]) {
+    irq_add_shared_handler(irq_num,
+                           irq_index ? dma_irq1_handler : dma_irq0_handler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(irq_num, true);
+    handler_added[irq_index] = true;
+  }
+  dma_irqn_set_channel_enabled(irq_index, channel, true);
+  return channel;
+}
+
+void dma_manager_unclaim(uint channel) {
+  dma_client_t &client = clients[channel];
+  if (client.cb) {
+    dma_irqn_set_channel_enabled(client.irq_index, channel, false);
+    irq_channels[client.irq_index] &= ~(1u << channel);
+    client = {};
+  }
+  dma_channel_unclaim(channel);
+}
+
+// Without a client there is no line to use, index 0 would be core 0's even
+// from core 1, and the shared handler would never acknowledge the channel
+static uint client_irq_index(uint channel) {
+  hard_assert(clients[channel].cb);
+  return clients[channel].irq_index;
+}
+
+void dma_manager_set_irq_enabled(uint channel, bool enabled) {
+  dma_irqn_set_channel_enabled(client_irq_index(channel), channel, enabled);
+}
+
+void dma_manager_acknowledge(uint channel) {
+  dma_irqn_acknowledge_channel(client_irq_index(channel), channel);
+}
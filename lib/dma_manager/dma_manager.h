@@ -0,0 +1,28 @@
+/**
+ * @file dma_manager.h
+ * @brief DMA channel and completion IRQ sharing for the RP2040 drivers
+ */
+#ifndef _DMA_MANAGER_H_
+#define _DMA_MANAGER_H_
+
+#include "hardware/dma.h"
+#include "pico/stdlib.h"
+
+// Runs in IRQ context on the core that claimed the channel, after the
+// channel's interrupt was acknowledged
+typedef void (*dma_complete_cb_t)(uint channel, void *user_data);
+
+// Claims a free channel, -1 when none is left and required is false. With a
+// callback the channel's completion interrupt goes to DMA_IRQ_0 when claimed
+// on core 0 and DMA_IRQ_1 on core 1, each served by one shared handler, so
+// drivers on either core don't take the line from each other.
+int dma_manager_claim(bool required, dma_complete_cb_t cb = nullptr,
+                      void *user_data = nullptr);
+void dma_manager_unclaim(uint channel);
+
+// Completion interrupt of a channel claimed with a callback, for drivers that
+// wait on a transfer themselves now and then. Asserts on any other channel.
+void dma_manager_set_irq_enabled(uint channel, bool enabled);
+void dma_manager_acknowledge(uint channel);
+
+#endif
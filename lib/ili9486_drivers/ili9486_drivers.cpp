@@ -4,6 +4,9 @@
  */
 #include "ili9486_drivers.h"
 
+#include "ili9486_spi.pio.h"
+#include "rgb565_to_666.pio.h"
+
 ILI9486Drivers::ILI9486Drivers(spi_inst_t *spi, uint8_t pin_cs,
                                  uint8_t pin_dc, uint8_t pin_rst, uint8_t mosi,
                                  uint8_t miso, uint8_t sck, uint32_t spi_clock,
@@ -51,30 +54,7 @@ void ILI9486Drivers::init() {
   printf("DMA used: %d\n", dma_used);
 
   // Send initialization commands
-  const uint8_t *initCommand_ptr = init_commands;
-  while (true) {
-    // Check for end marker
-    if (initCommand_ptr[0] == 0xFF && initCommand_ptr[1] == 0xFF)
-      break;
-
-    uint8_t cmd = *initCommand_ptr++;
-    uint8_t next = *initCommand_ptr++;
-
-    if (next == CMD_Delay) {
-      // Handle delay
-      uint8_t delay_ms = *initCommand_ptr++;
-      write_command(cmd);
-      sleep_ms(delay_ms);
-    } else {
-      // Handle parameters
-      uint8_t param_count = next;
-      write_command(cmd);
-      for (uint8_t i = 0; i < param_count; i++) {
-        uint8_t data = *initCommand_ptr++;
-        write_data(data);
-      }
-    }
-  }
+  write_command_stream(init_commands, sizeof(init_commands));
   set_rotation(LANDSCAPE);
   fill_screen((uint32_t)0); // Clear screen
 }
@@ -83,7 +63,7 @@ void ILI9486Drivers::draw_pixel(int16_t x, int16_t y, uint32_t color) {
   if ((x < 0) || (x >= _width) || (y < 0) || (y >= _height))
     return;
 
-  set_address_window(x, y, x, y);
+  set_window(x, y, x, y);
   push_block(color, 1);
 }
 
@@ -114,16 +94,55 @@ void ILI9486Drivers::set_rotation(Rotations rotation) {
     break;
   }
 
-  start_transaction();
-  write_command(CMD_MemoryAccessControl);
-  write_data(madctl);
-  end_transaction();
+  ILI9486CommandStream stream;
+  stream.command(CMD_MemoryAccessControl);
+  stream.param(madctl);
+  write_command_stream(stream);
 
   // Update dimensions based on orientation
   _width = swap_dims ? panel_height : panel_width;
   _height = swap_dims ? panel_width : panel_height;
 }
 
+void ILI9486Drivers::set_scroll_area(uint16_t top_fixed, uint16_t scroll_lines,
+                                     uint16_t bottom_fixed) {
+  ILI9486CommandStream stream;
+  stream.command(CMD_VerticalScrollingDefinition);
+  stream.param16(top_fixed);
+  stream.param16(scroll_lines);
+  stream.param16(bottom_fixed);
+  write_command_stream(stream);
+}
+
+void ILI9486Drivers::set_scroll_start(uint16_t line) {
+  ILI9486CommandStream stream;
+  stream.command(CMD_VerticalScrollingStartAddress);
+  stream.param16(line);
+  write_command_stream(stream);
+}
+
+void ILI9486Drivers::scroll_reset() {
+  ILI9486CommandStream stream;
+  stream.command(CMD_VerticalScrollingDefinition);
+  stream.param16(0);
+  stream.param16(panel_height);
+  stream.param16(0);
+  stream.command(CMD_VerticalScrollingStartAddress);
+  stream.param16(0);
+  write_command_stream(stream);
+}
+
+void ILI9486Drivers::set_tearing_effect(bool on) {
+  ILI9486CommandStream stream;
+  if (on) {
+    stream.command(CMD_TearingEffectLineOn);
+    stream.param(0x00); // V-blank only
+  } else {
+    stream.command(CMD_TearingEffectLineOff);
+  }
+  write_command_stream(stream);
+}
+
 void ILI9486Drivers::write_command(uint8_t cmd) {
   start_transaction();
   gpio_put(pin_dc, 0);
@@ -138,41 +157,172 @@ void ILI9486Drivers::write_data(uint8_t data) {
   end_transaction();
 }
 
+void ILI9486Drivers::write_command_stream(const uint8_t *stream, size_t len) {
+  size_t pos = 0;
+  if (pio_used) {
+    pio_wait_idle();
+    while (pos + 1 < len) {
+      if (stream[pos] == 0xFF && stream[pos + 1] == 0xFF)
+        break;
+      uint8_t cmd = stream[pos++];
+      uint8_t next = stream[pos++];
+      uint8_t count = next == CMD_Delay ? 0 : next;
+      pio_sm_put_blocking(bus_pio, bus_sm, count);
+      pio_sm_put_blocking(bus_pio, bus_sm, (uint32_t)cmd << 24);
+      for (uint8_t i = 0; i < count; i++)
+        pio_sm_put_blocking(bus_pio, bus_sm, (uint32_t)stream[pos++] << 24);
+      if (next == CMD_Delay) {
+        pio_wait_idle();
+        sleep_ms(stream[pos++]);
+      }
+    }
+    pio_wait_idle();
+    return;
+  }
+
+  start_transaction();
+  while (pos + 1 < len) {
+    // Check for end marker
+    if (stream[pos] == 0xFF && stream[pos + 1] == 0xFF)
+      break;
+
+    uint8_t cmd = stream[pos++];
+    uint8_t next = stream[pos++];
+
+    // spi_write_blocking returns with the line idle, so DC can change
+    gpio_put(pin_dc, 0);
+    spi_write_blocking(spi, &cmd, 1);
+    if (next == CMD_Delay) {
+      sleep_ms(stream[pos++]);
+    } else if (next > 0) {
+      gpio_put(pin_dc, 1);
+      spi_write_blocking(spi, &stream[pos], next);
+      pos += next;
+    }
+  }
+  gpio_put(pin_dc, 1);
+  end_transaction();
+}
+
+bool ILI9486Drivers::write_command_stream(const ILI9486CommandStream &stream) {
+  // A truncated sequence would leave the panel with half a command
+  if (stream.overflowed())
+    return false;
+  write_command_stream(stream.data(), stream.size());
+  return true;
+}
+
 void ILI9486Drivers::set_window(int32_t x0, int32_t y0, int32_t x1,
                                 int32_t y1) {
-  write_command(CMD_ColumnAddressSet);
-  write_data(x0 >> 8);
-  write_data(x0 & 0xFF);
-  write_data(x1 >> 8);
-  write_data(x1 & 0xFF);
-
-  write_command(CMD_PageAddressSet);
-  write_data(y0 >> 8);
-  write_data(y0 & 0xFF);
-  write_data(y1 >> 8);
-  write_data(y1 & 0xFF);
+  if (pio_used) {
+    // Header and command words, parameters one byte per word in bits 31:24
+    uint32_t *w = window_words;
+    *w++ = 4;
+    *w++ = (uint32_t)CMD_ColumnAddressSet << 24;
+    *w++ = (uint32_t)(x0 >> 8) << 24;
+    *w++ = (uint32_t)(x0 & 0xFF) << 24;
+    *w++ = (uint32_t)(x1 >> 8) << 24;
+    *w++ = (uint32_t)(x1 & 0xFF) << 24;
+    *w++ = 4;
+    *w++ = (uint32_t)CMD_PageAddressSet << 24;
+    *w++ = (uint32_t)(y0 >> 8) << 24;
+    *w++ = (uint32_t)(y0 & 0xFF) << 24;
+    *w++ = (uint32_t)(y1 >> 8) << 24;
+    *w++ = (uint32_t)(y1 & 0xFF) << 24;
+    *w++ = 0; // Pixel byte count, filled in when the pixels are pushed
+    *w++ = (uint32_t)CMD_MemoryWrite << 24;
+    return;
+  }
 
-  write_command(CMD_MemoryWrite);
+  // One CS assertion and 5 DC edges instead of 11 single byte transfers
+  window_stream.clear();
+  window_stream.command(CMD_ColumnAddressSet);
+  window_stream.param16(x0);
+  window_stream.param16(x1);
+  window_stream.command(CMD_PageAddressSet);
+  window_stream.param16(y0);
+  window_stream.param16(y1);
+  window_stream.command(CMD_MemoryWrite);
+  write_command_stream(window_stream);
 }
 
 void ILI9486Drivers::push_block(uint32_t color, uint32_t len) {
   uint8_t color_buf[3] = {static_cast<uint8_t>(color >> 16),
                           static_cast<uint8_t>(color >> 8),
                           static_cast<uint8_t>(color & 0xFF)};
+  // Whole lines go out by DMA, the rest byte by byte
+  uint32_t rows = dma_used ? len / fill_line_px : 0;
+  uint32_t rest = len - rows * fill_line_px;
+  if (pio_used) {
+    pio_send_window(len * 3);
+    if (rows)
+      fill_dma_rows(color_buf, rows);
+    for (uint32_t i = 0; i < rest; i++)
+      for (uint8_t b : color_buf)
+        pio_sm_put_blocking(bus_pio, bus_sm, (uint32_t)b << 24);
+    return;
+  }
   start_transaction();
   gpio_put(pin_dc, 1);
-  for (uint32_t i = 0; i < len; i++) {
+  if (rows)
+    fill_dma_rows(color_buf, rows);
+  for (uint32_t i = 0; i < rest; i++) {
     spi_write_blocking(spi, color_buf, 3);
   }
   end_transaction();
 }
 
+void ILI9486Drivers::fill_dma_rows(const uint8_t color[3], uint32_t rows) {
+  for (uint32_t i = 0; i < fill_line_px * 3; i += 3) {
+    fill_line[i] = color[0];
+    fill_line[i + 1] = color[1];
+    fill_line[i + 2] = color[2];
+  }
+  // The first line is triggered below, the null entry ends the chain and
+  // raises the channel IRQ (quiet mode skips the per line ones)
+  for (uint32_t r = 0; r + 1 < rows; r++)
+    fill_rows[r] = fill_line;
+  fill_rows[rows - 1] = nullptr;
+
+  dma_channel_config config = pio_used ? dma_pio_pixel_config : dma_tx_config;
+  channel_config_set_irq_quiet(&config, true);
+  channel_config_set_chain_to(&config, dma_fill_ctrl_channel);
+  volatile void *dst =
+      pio_used ? (volatile void *)&bus_pio->txf[bus_sm] : &spi_get_hw(spi)->dr;
+
+  // Blocking, keep the completion callback out of it
+  dma_manager_set_irq_enabled(dma_tx_channel, false);
+  dma_channel_configure(dma_fill_ctrl_channel, &dma_fill_ctrl_config,
+                        &dma_hw->ch[dma_tx_channel].al3_read_addr_trig,
+                        fill_rows, 1, false);
+  dma_channel_configure(dma_tx_channel, &config, dst, fill_line,
+                        fill_line_px * 3, true);
+  while (!(dma_hw->intr & (1u << dma_tx_channel)))
+    tight_loop_contents();
+  dma_manager_acknowledge(dma_tx_channel);
+  dma_manager_set_irq_enabled(dma_tx_channel, true);
+}
+
+void ILI9486Drivers::fill_rect(int32_t x, int32_t y, int32_t w, int32_t h,
+                               uint32_t color) {
+  if (w <= 0 || h <= 0)
+    return;
+  set_address_window(x, y, w, h);
+  push_block(color, w * h);
+}
+
 void ILI9486Drivers::fill_screen(uint32_t color) {
-  set_address_window(0, 0, _width, _height);
-  push_block(color, _width * _height);
+  fill_rect(0, 0, _width, _height, color);
 }
 
 void ILI9486Drivers::push_colors(uint32_t *color, uint32_t len) {
+  if (pio_used) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(color);
+    pio_send_window(len * 3);
+    for (uint32_t i = 0; i < len * 3; i++)
+      pio_sm_put_blocking(bus_pio, bus_sm, (uint32_t)bytes[i] << 24);
+    return;
+  }
   start_transaction();
   gpio_put(pin_dc, 1);
   spi_write_blocking(spi, reinterpret_cast<uint8_t *>(color), len * 3);
@@ -180,46 +330,176 @@ void ILI9486Drivers::push_colors(uint32_t *color, uint32_t len) {
 }
 
 void ILI9486Drivers::dma_init(void (*onComplete_cb)(void)) {
-  dma_tx_channel = dma_claim_unused_channel(true);
+  complete_cb = onComplete_cb;
+  // Completions are dispatched on the calling core's DMA IRQ line, shared
+  // with the other drivers' channels
+  dma_tx_channel = dma_manager_claim(
+      true,
+      [](uint channel, void *user_data) {
+        ILI9486Drivers *tft = static_cast<ILI9486Drivers *>(user_data);
+        if (tft->complete_cb)
+          tft->complete_cb();
+      },
+      this);
   dma_tx_config = dma_channel_get_default_config(dma_tx_channel);
   channel_config_set_transfer_data_size(&dma_tx_config, DMA_SIZE_8);
   channel_config_set_dreq(&dma_tx_config, spi_get_dreq(spi, true));
-  uint irq_num = (dma_tx_channel <= 3) ? DMA_IRQ_0 : DMA_IRQ_1;
-  static int captured_dma_tx_channel = dma_tx_channel; // Capture the channel
-  static void (*user_callback)(void) = onComplete_cb;
-  irq_handler_t wrapper = [](void) {
-    if (dma_channel_get_irq0_status(captured_dma_tx_channel)) {
-      dma_channel_acknowledge_irq0(captured_dma_tx_channel);
-      if (user_callback) {
-        user_callback();
-      }
-    }
-  };
 
-  irq_remove_handler(irq_num, wrapper);
-  irq_set_exclusive_handler(irq_num, wrapper);
+  dma_fill_ctrl_channel = dma_manager_claim(true);
+  dma_fill_ctrl_config = dma_channel_get_default_config(dma_fill_ctrl_channel);
 
-  dma_channel_set_irq0_enabled(dma_tx_channel, true);
-  irq_set_enabled(irq_num, true);
+  dma_mem_channel = dma_manager_claim(true);
+  dma_mem_config = dma_channel_get_default_config(dma_mem_channel);
+  channel_config_set_transfer_data_size(&dma_mem_config, DMA_SIZE_16);
+  channel_config_set_read_increment(&dma_mem_config, false);
+  channel_config_set_write_increment(&dma_mem_config, true);
 
   dma_used = true;
 }
 
+void ILI9486Drivers::dma_fill16(void *dst, uint16_t value, uint32_t count) {
+  fill16_value = value;
+  dma_channel_configure(dma_mem_channel, &dma_mem_config, dst, &fill16_value,
+                        count, true);
+}
+
 void ILI9486Drivers::push_colors_dma(uint32_t *colors, uint32_t len) {
   if (!dma_used)
     return;
   gpio_put(pin_dc, 1);
 
-  // Configure DMA transfer
-  uint8_t *src = reinterpret_cast<uint8_t *>(colors);
-  const uint32_t transfer_size = len * 3; // 3 bytes per pixel
+  // 3 bytes per pixel
+  start_pixel_dma(colors, pio_used ? &dma_pio_pixel_config : &dma_tx_config,
+                  len * 3);
+}
 
-  dma_channel_configure(dma_tx_channel, &dma_tx_config,
-                        &spi_get_hw(spi)->dr, // SPI data register (destination)
-                        src,                  // Source buffer
-                        transfer_size,        // Transfer size in bytes
-                        true                  // Start immediately
+void ILI9486Drivers::start_pixel_dma(const volatile void *src,
+                                     const dma_channel_config *config,
+                                     uint32_t bytes) {
+  if (!pio_used) {
+    dma_channel_configure(dma_tx_channel, config,
+                          &spi_get_hw(spi)->dr, // SPI data register
+                          src,                  // Source buffer
+                          bytes,                // Transfer size in bytes
+                          true                  // Start immediately
+    );
+    return;
+  }
+
+  // Window words first, the command channel then triggers the pixels
+  window_words[window_ramwr_header] = bytes;
+  dma_channel_configure(dma_tx_channel, config, &bus_pio->txf[bus_sm], src,
+                        bytes, false);
+  dma_channel_configure(dma_cmd_channel, &dma_cmd_config, &bus_pio->txf[bus_sm],
+                        window_words, 14, true);
+}
+
+void ILI9486Drivers::pio_send_window(uint32_t bytes) {
+  pio_wait_idle();
+  window_words[window_ramwr_header] = bytes;
+  for (uint32_t word : window_words)
+    pio_sm_put_blocking(bus_pio, bus_sm, word);
+}
+
+void ILI9486Drivers::pio_wait_idle() {
+  const uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + bus_sm);
+  while (dma_channel_is_busy(dma_cmd_channel) ||
+         dma_channel_is_busy(dma_tx_channel))
+    tight_loop_contents();
+  while (!pio_sm_is_tx_fifo_empty(bus_pio, bus_sm))
+    tight_loop_contents();
+  // The program stalls on the next header once the last byte is out
+  bus_pio->fdebug = stall;
+  while (!(bus_pio->fdebug & stall))
+    tight_loop_contents();
+}
+
+bool ILI9486Drivers::pio_init(PIO pio, uint32_t sck_hz) {
+  if (!dma_used || pin_cs != pin_dc + 1 ||
+      !pio_can_add_program(pio, &ili9486_spi_program))
+    return false;
+  int sm = pio_claim_unused_sm(pio, false);
+  if (sm < 0)
+    return false;
+  int ch = dma_manager_claim(false);
+  if (ch < 0) {
+    pio_sm_unclaim(pio, sm);
+    return false;
+  }
+
+  // Let the SPI block finish before its pins move over
+  dma_wait();
+  while (spi_is_busy(spi))
+    tight_loop_contents();
+
+  bus_pio = pio;
+  bus_sm = sm;
+  dma_cmd_channel = ch;
+  // 2 PIO cycles per bit
+  float clkdiv = (float)clock_get_hz(clk_sys) / (2.0f * sck_hz);
+  ili9486_spi_program_init(pio, sm, pio_add_program(pio, &ili9486_spi_program),
+                           pin_sck, pin_mosi, pin_dc, clkdiv < 1 ? 1 : clkdiv);
+
+  dma_pio_pixel_config = dma_channel_get_default_config(dma_tx_channel);
+  channel_config_set_transfer_data_size(&dma_pio_pixel_config, DMA_SIZE_8);
+  channel_config_set_dreq(&dma_pio_pixel_config, pio_get_dreq(pio, sm, true));
+
+  dma_cmd_config = dma_channel_get_default_config(dma_cmd_channel);
+  channel_config_set_transfer_data_size(&dma_cmd_config, DMA_SIZE_32);
+  channel_config_set_dreq(&dma_cmd_config, pio_get_dreq(pio, sm, true));
+  channel_config_set_chain_to(&dma_cmd_config, dma_tx_channel);
+
+  pio_used = true;
+  set_window(0, 0, _width - 1, _height - 1);
+  return true;
+}
+
+bool ILI9486Drivers::rgb565_init(PIO pio) {
+  if (!dma_used || !pio_can_add_program(pio, &rgb565_to_666_program))
+    return false;
+  int sm = pio_claim_unused_sm(pio, false);
+  if (sm < 0)
+    return false;
+  conv_pio = pio;
+  conv_sm = sm;
+  rgb565_to_666_program_init(pio, sm,
+                             pio_add_program(pio, &rgb565_to_666_program));
+
+  // Pixels into the expander, paced by its TX FIFO
+  dma_conv_channel = dma_manager_claim(true);
+  dma_conv_config = dma_channel_get_default_config(dma_conv_channel);
+  channel_config_set_transfer_data_size(&dma_conv_config, DMA_SIZE_16);
+  channel_config_set_dreq(&dma_conv_config, pio_get_dreq(pio, sm, true));
+  // Ahead of the fill and touch channels so the expander never starves
+  channel_config_set_high_priority(&dma_conv_config, true);
+
+  // Expanded bytes out to the bus on the completion IRQ channel, paced by the
+  // bus so it reads one RX FIFO word per byte sent
+  dma_expanded_config = pio_used ? dma_pio_pixel_config : dma_tx_config;
+  channel_config_set_read_increment(&dma_expanded_config, false);
+
+  rgb565_used = true;
+  return true;
+}
+
+void ILI9486Drivers::push_colors_dma(uint16_t *colors, uint32_t len) {
+  if (!rgb565_used)
+    return;
+  gpio_put(pin_dc, 1);
+
+  dma_channel_configure(dma_conv_channel, &dma_conv_config,
+                        &conv_pio->txf[conv_sm], // Expander input
+                        colors,                  // Source buffer
+                        len,                     // One transfer per pixel
+                        true                     // Start immediately
   );
+  // The bus side is paced by the bus and reads without checking the RX FIFO
+  // level, let the expander fill it first on either bus. After that it
+  // refills 5x faster than the bus drains it.
+  const uint32_t prefill = len * 3 < 4 ? len * 3 : 4;
+  while (pio_sm_get_rx_fifo_level(conv_pio, conv_sm) < prefill)
+    tight_loop_contents();
+  start_pixel_dma(&conv_pio->rxf[conv_sm], &dma_expanded_config, len * 3);
 }
 
 uint32_t ILI9486Drivers::create_888_color(uint8_t r, uint8_t g, uint8_t b) {
@@ -235,6 +515,16 @@ void ILI9486Drivers::set_address_window(int32_t x, int32_t y, int32_t w,
   set_window(x, y, x + w - 1, y + h - 1);
 }
 
-// Transaction management
-void ILI9486Drivers::start_transaction() { gpio_put(pin_cs, 0); }
-void ILI9486Drivers::end_transaction() { gpio_put(pin_cs, 1); }
\ No newline at end of file
+// Transaction management, the PIO bus drives CS itself
+void ILI9486Drivers::start_transaction() {
+  if (!pio_used)
+    gpio_put(pin_cs, 0);
+}
+void ILI9486Drivers::end_transaction() {
+  if (pio_used)
+    return;
+  // DMA completes once the last byte is in the TX FIFO, let it shift out
+  while (spi_is_busy(spi))
+    tight_loop_contents();
+  gpio_put(pin_cs, 1);
+}
\ No newline at end of file
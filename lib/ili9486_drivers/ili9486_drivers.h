@@ -5,9 +5,12 @@
 #ifndef _ILI9486_DRIVERS_H_
 #define _ILI9486_DRIVERS_H_
 
+#include "hardware/clocks.h"
 #include "hardware/dma.h"
 #include "hardware/spi.h"
 #include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "dma_manager.h"
 #include "ili9486_commands.h"
 
 #include "pico/stdlib.h"
@@ -16,9 +19,52 @@
 // Panel parameters
 static constexpr uint16_t panel_width = 320;
 static constexpr uint16_t panel_height = 480;
+// Solid fills go out by DMA as repeats of one line this long
+static constexpr uint32_t fill_line_px = panel_height;
 
 enum Rotations { PORTRAIT, LANDSCAPE, INVERTED_PORTRAIT, INVERTED_LANDSCAPE };
 
+// Builds a command sequence in the init_commands encoding (command, parameter
+// count or CMD_Delay, parameters) to send with write_command_stream(). Bytes
+// past the buffer are dropped and set overflowed(), such a stream is refused.
+class ILI9486CommandStream {
+public:
+  void clear() {
+    len = 0;
+    overflow = false;
+  }
+  void command(uint8_t cmd) {
+    if (len + 2 > sizeof(buf)) {
+      overflow = true;
+      return;
+    }
+    buf[len++] = cmd;
+    count_pos = len;
+    buf[len++] = 0;
+  }
+  void param(uint8_t value) {
+    if (len == 0 || len >= sizeof(buf)) {
+      overflow = true;
+      return;
+    }
+    buf[len++] = value;
+    buf[count_pos]++;
+  }
+  void param16(uint16_t value) {
+    param(value >> 8);
+    param(value & 0xFF);
+  }
+  const uint8_t *data() const { return buf; }
+  size_t size() const { return len; }
+  bool overflowed() const { return overflow; }
+
+private:
+  uint8_t buf[32];
+  size_t len = 0;
+  size_t count_pos = 0;
+  bool overflow = false;
+};
+
 class ILI9486Drivers {
 public:
   ILI9486Drivers(spi_inst_t *spi, uint8_t pin_cs, uint8_t pin_dc,
@@ -32,11 +78,23 @@ public:
   uint32_t create_666_color(uint8_t r, uint8_t g, uint8_t b);
   void push_colors_dma(uint16_t *colors, uint32_t len);
   void fill_screen(uint32_t color);
+  void fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
   void push_colors(uint32_t *color, uint32_t len);
   void push_colors_dma(uint32_t *colors, uint32_t len);
   void draw_pixel(int16_t x, int16_t y, uint32_t color);
   void dma_init(void (*onComplete_cb)(void));
   bool is_dma_used() { return dma_used; }
+  // Expands RGB565 to the 18 bit SPI format in PIO for push_colors_dma(uint16_t
+  // *), call after dma_init and pio_init. False when pio has no free state
+  // machine or room.
+  bool rgb565_init(PIO pio);
+  bool is_rgb565_used() { return rgb565_used; }
+  // Moves SCK, MOSI, DC and CS from the SPI block to a PIO state machine
+  // (ili9486_spi.pio). DC and CS come from the stream, so a window and its
+  // pixels go out as one DMA chain without the CPU. Call after init() and
+  // dma_init(), CS must be the GPIO after DC. False leaves hardware SPI on.
+  bool pio_init(PIO pio, uint32_t sck_hz);
+  bool is_pio_used() { return pio_used; }
 
 
   // DMA control functions
@@ -44,19 +102,44 @@ public:
   __force_inline void dma_wait() {
     dma_channel_wait_for_finish_blocking(dma_tx_channel);
   };
-  __force_inline void dma_clear_irq() { dma_hw->ints0 = 1u << dma_tx_channel; }
+  __force_inline void dma_clear_irq() { dma_manager_acknowledge(dma_tx_channel); }
+
+  // Memory fill on its own channel, repeats value count times from dst on.
+  // Meant for draw buffers, runs alongside a pixel transfer.
+  void dma_fill16(void *dst, uint16_t value, uint32_t count);
+  __force_inline bool dma_fill16_busy() {
+    return dma_channel_is_busy(dma_mem_channel);
+  }
 
   // Display properties
   __force_inline uint16_t width() { return _width; }
   __force_inline uint16_t height() { return _height; }
   void set_rotation(Rotations rotation);
+  Rotations rotation() { return _rot; }
+
+  // Vertical scrolling along the panel's 480 native rows (screen x in
+  // LANDSCAPE). The three counts must add up to panel_height, line is the
+  // native row shown first in the scroll area. scroll_reset() restores the
+  // identity mapping.
+  void set_scroll_area(uint16_t top_fixed, uint16_t scroll_lines,
+                       uint16_t bottom_fixed);
+  void set_scroll_start(uint16_t line);
+  void scroll_reset();
+  // Pulses the TE output once per frame, at the start of vertical blanking
+  void set_tearing_effect(bool on);
 
   // Transaction control
   void start_transaction();
   void end_transaction();
 
+  // Hardware SPI only, use write_command_stream() once pio_init() succeeded
   void write_command(uint8_t cmd);
   void write_data(uint8_t data);
+  // Sends a whole command sequence under one CS, DC only changes between
+  // a command and its parameters. Stops at len or the 0xFF 0xFF end marker.
+  void write_command_stream(const uint8_t *stream, size_t len);
+  // Same on either bus, false and nothing sent if the stream overflowed
+  bool write_command_stream(const ILI9486CommandStream &stream);
   void push_block(uint32_t color, uint32_t len);
 
 
@@ -69,8 +152,45 @@ private:
   // DMA configuration
   int dma_tx_channel;
   dma_channel_config dma_tx_config;
+  void (*complete_cb)(void) = nullptr;
   bool dma_used = false;
   uint32_t spi_clock;
+
+  // RGB565 path: pixels -> PIO expander -> SPI
+  PIO conv_pio;
+  uint conv_sm;
+  int dma_conv_channel;
+  dma_channel_config dma_conv_config;
+  dma_channel_config dma_expanded_config;
+  bool rgb565_used = false;
+
+  // PIO bus: CASET, PASET and RAMWR words queued by set_window, sent with
+  // the pixels once their count is known
+  static constexpr size_t window_ramwr_header = 12;
+  PIO bus_pio;
+  uint bus_sm;
+  int dma_cmd_channel;
+  dma_channel_config dma_cmd_config;
+  dma_channel_config dma_pio_pixel_config;
+  uint32_t window_words[14];
+  bool pio_used = false;
+
+  // Solid fills: the pixel channel sends fill_line, chains to the control
+  // channel which retriggers it from fill_rows until the null entry
+  int dma_fill_ctrl_channel;
+  dma_channel_config dma_fill_ctrl_config;
+  uint8_t fill_line[fill_line_px * 3];
+  const uint8_t *fill_rows[panel_width * panel_height / fill_line_px];
+  int dma_mem_channel;
+  dma_channel_config dma_mem_config;
+  uint16_t fill16_value;
+
+  void start_pixel_dma(const volatile void *src,
+                       const dma_channel_config *config, uint32_t bytes);
+  void pio_send_window(uint32_t bytes);
+  void pio_wait_idle();
+  void fill_dma_rows(const uint8_t color[3], uint32_t rows);
+  ILI9486CommandStream window_stream;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "modbus_capture.h"
+
+void ModbusCapture::clear() {
+  paused      = true;
+  tail        = head;
+  overwritten = 0;
+  open_rx     = -1;
+  paused      = false;
+}
+
+void ModbusCapture::make_room(uint32_t needed) {
+  while (head - tail + needed > MODBUS_CAPTURE_SIZE) {
+    if (open_rx == (int64_t) tail)
+      open_rx = -1;
+    tail += MODBUS_CAPTURE_RECORD_HEADER_LEN + at(tail + 1);
+    overwritten++;
+  }
+}
+
+void ModbusCapture::record(modbus_capture_type_t type, const uint8_t *data, size_t len, uint32_t now_us) {
+  if (!enabled || paused)
+    return;
+  if (len > 255)
+    len = 255;
+  make_room(MODBUS_CAPTURE_RECORD_HEADER_LEN + len);
+  at(head)     = type;
+  at(head + 1) = len;
+  for (int i = 0; i < 4; i++) at(head + 2 + i) = now_us >> (8 * i);
+  for (size_t i = 0; i < len; i++) at(head + MODBUS_CAPTURE_RECORD_HEADER_LEN + i) = data[i];
+  open_rx = type == Capture_RX ? (int64_t) head : -1;
+  head += MODBUS_CAPTURE_RECORD_HEADER_LEN + len;
+}
+
+void ModbusCapture::record_rx(uint8_t c, uint32_t now_us, uint32_t gap_us) {
+  if (!enabled || paused)
+    return;
+  bool same_burst = open_rx >= 0 && now_us - last_rx_us <= gap_us && at(open_rx + 1) < 255;
+  last_rx_us      = now_us;
+  if (same_burst) {
+    make_room(1);
+    // make_room drops whole records from the tail, the open one is only at risk when it fills the ring alone
+    if (open_rx >= 0) {
+      at(head++) = c;
+      at(open_rx + 1)++;
+      return;
+    }
+  }
+  record(Capture_RX, &c, 1, now_us);
+}
+
+size_t ModbusCapture::export_to(void (*put)(uint8_t c)) {
+  paused = true;
+
+  uint32_t bytes = head - tail;
+  for (int i = 0; i < 4; i++) put(MODBUS_CAPTURE_MAGIC[i]);
+  put(MODBUS_CAPTURE_VERSION & 0xFF);
+  put(MODBUS_CAPTURE_VERSION >> 8);
+  for (int i = 0; i < 4; i++) put(bytes >> (8 * i));
+  for (int i = 0; i < 4; i++) put(overwritten >> (8 * i));
+  for (uint32_t pos = tail; pos != head; pos++) put(at(pos));
+
+  paused = false;
+  return MODBUS_CAPTURE_HEADER_LEN + bytes;
+}
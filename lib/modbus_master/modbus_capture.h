@@ -0,0 +1,67 @@
+#ifndef MODBUS_CAPTURE_H
+#define MODBUS_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bus traffic capture. Every TX frame, every RX burst and the outcome of every transaction is kept in a
+// RAM ring as a record, the oldest records are overwritten once the ring is full. Kept free of SDK
+// includes, tools/modbus_capture.cpp parses the same format on the host.
+//
+// Export format, all little endian:
+//   header: magic "MBCP" (4), version (2), record bytes (4), overwritten records (4)
+//   record: type (1), length (1), timestamp in us (4, wraps every ~71 minutes), length data bytes
+// Event records carry one byte, the modbus_transaction_status_t the transaction finished with.
+
+#define MODBUS_CAPTURE_SIZE 8192U  // Must be a power of two
+#define MODBUS_CAPTURE_MAGIC "MBCP"
+#define MODBUS_CAPTURE_VERSION 1U
+#define MODBUS_CAPTURE_HEADER_LEN 14U
+#define MODBUS_CAPTURE_RECORD_HEADER_LEN 6U
+
+typedef enum {
+  Capture_TX    = 1,
+  Capture_RX    = 2,
+  Capture_Event = 3,
+} modbus_capture_type_t;
+
+class ModbusCapture {
+ public:
+  void set_enabled(bool enabled) { this->enabled = enabled; }
+  bool is_enabled() { return enabled; }
+  void clear();
+
+  // Frames longer than 255 bytes (only a maximum size PDU) lose their last CRC byte
+  void record(modbus_capture_type_t type, const uint8_t *data, size_t len, uint32_t now_us);
+
+  /**
+   * @brief Append a received byte to the open RX burst, or start a new one
+   * A burst ends when a record of another type comes in between or the line was idle for more than gap_us.
+   */
+  void record_rx(uint8_t c, uint32_t now_us, uint32_t gap_us);
+
+  /**
+   * @brief Write the header and every record, oldest first, through put
+   * Recording is paused meanwhile, so the ring is consistent even if bus traffic goes on.
+   * @return Number of bytes written
+   */
+  size_t export_to(void (*put)(uint8_t c));
+
+  uint32_t get_used() { return head - tail; }
+  uint32_t get_overwritten() { return overwritten; }
+
+ private:
+  uint8_t       ring[MODBUS_CAPTURE_SIZE];
+  uint32_t      head        = 0;  // Free running, masked on access
+  uint32_t      tail        = 0;
+  uint32_t      overwritten = 0;
+  int64_t       open_rx     = -1;  // Position of the RX record still collecting bytes
+  uint32_t      last_rx_us  = 0;
+  volatile bool enabled     = false;
+  volatile bool paused      = false;
+
+  uint8_t &at(uint32_t pos) { return ring[pos & (MODBUS_CAPTURE_SIZE - 1)]; }
+  void     make_room(uint32_t needed);
+};
+
+#endif
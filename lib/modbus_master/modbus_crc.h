@@ -0,0 +1,52 @@
+#ifndef MODBUS_CRC_H
+#define MODBUS_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-16/MODBUS: reflected polynomial 0xA001, init 0xFFFF, sent low byte first.
+// Running the CRC over a whole frame including its two CRC bytes leaves 0 when the frame is intact,
+// which is what the receive path relies on to validate while bytes arrive.
+// Kept free of SDK includes so the same code builds in the host tools.
+
+static constexpr uint16_t MODBUS_CRC_INIT = 0xFFFF;
+static constexpr uint16_t MODBUS_CRC_POLY = 0xA001;
+
+struct modbus_crc_table_t {
+  uint16_t byte[256];
+  uint16_t nibble[16];
+};
+
+static constexpr uint16_t modbus_crc_shift(uint16_t crc, int bits) {
+  for (int i = 0; i < bits; i++) crc = (crc & 0x0001) ? (crc >> 1) ^ MODBUS_CRC_POLY : crc >> 1;
+  return crc;
+}
+
+static constexpr modbus_crc_table_t modbus_crc_make_table() {
+  modbus_crc_table_t table = {};
+  for (int i = 0; i < 256; i++) table.byte[i] = modbus_crc_shift(i, 8);
+  for (int i = 0; i < 16; i++) table.nibble[i] = modbus_crc_shift(i, 4);
+  return table;
+}
+
+static constexpr modbus_crc_table_t modbus_crc_table = modbus_crc_make_table();
+
+// 512 byte table, one lookup per byte. Used everywhere on the target.
+static inline uint16_t modbus_crc_update(uint16_t crc, uint8_t byte) { return (crc >> 8) ^ modbus_crc_table.byte[(crc ^ byte) & 0xFF]; }
+
+// 32 byte table, two lookups per byte. Worth it only where flash/cache footprint matters more than cycles.
+static inline uint16_t modbus_crc_update_nibble(uint16_t crc, uint8_t byte) {
+  crc ^= byte;
+  crc = (crc >> 4) ^ modbus_crc_table.nibble[crc & 0x0F];
+  return (crc >> 4) ^ modbus_crc_table.nibble[crc & 0x0F];
+}
+
+// Reference implementation, 8 shifts per byte
+static inline uint16_t modbus_crc_update_bitwise(uint16_t crc, uint8_t byte) { return modbus_crc_shift(crc ^ byte, 8); }
+
+static inline uint16_t modbus_crc16(const uint8_t *buf, size_t len, uint16_t crc = MODBUS_CRC_INIT) {
+  for (size_t i = 0; i < len; i++) crc = modbus_crc_update(crc, buf[i]);
+  return crc;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MODBUS_HAL_H
+#define MODBUS_HAL_H
+
+// Everything ModbusMaster and the slave drivers need from the chip: the UART, the DE/RE pin, time and one
+// shot alarms. On the Pico these are inline forwards to the SDK. Building with MODBUS_HAL_HOST swaps in
+// tools/modbus_sim/modbus_hal_host.h instead, which runs the same engine against a simulated RS-485 bus.
+// MODBUS_HAL_PIO tells whether the PIO backend (init_pio) is available.
+
+#ifdef MODBUS_HAL_HOST
+#include "modbus_hal_host.h"
+#else
+#include "dma_manager.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "rs485_uart.pio.h"
+
+#define MODBUS_HAL_PIO 1
+
+typedef void (*modbus_hal_irq_handler_t)();
+typedef int64_t (*modbus_hal_alarm_cb_t)(alarm_id_t id, void *user_data);
+
+// UART with the FIFO disabled, so the RX interrupt fires for every byte
+static inline void modbus_hal_uart_init(uart_inst_t *uart, uint tx_pin, uint rx_pin, uint baud_rate, uint data_bits, uint stop_bits,
+                                        uart_parity_t parity) {
+  uart_init(uart, baud_rate);
+  gpio_set_function(rx_pin, GPIO_FUNC_UART);
+  gpio_set_function(tx_pin, GPIO_FUNC_UART);
+  uart_set_hw_flow(uart, false, false);
+  uart_set_format(uart, data_bits, stop_bits, parity);
+  uart_set_fifo_enabled(uart, false);
+}
+
+static inline void modbus_hal_uart_set_baudrate(uart_inst_t *uart, uint baud_rate) { uart_set_baudrate(uart, baud_rate); }
+static inline void modbus_hal_uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity) {
+  uart_set_format(uart, data_bits, stop_bits, parity);
+}
+static inline bool    modbus_hal_uart_is_readable(uart_inst_t *uart) { return uart_is_readable(uart); }
+static inline uint8_t modbus_hal_uart_getc(uart_inst_t *uart) { return (uint8_t) uart_getc(uart); }
+static inline bool    modbus_hal_uart_is_writable(uart_inst_t *uart) { return uart_is_writable(uart); }
+static inline void    modbus_hal_uart_putc(uart_inst_t *uart, uint8_t c) { uart_putc_raw(uart, c); }
+static inline void    modbus_hal_uart_write_blocking(uart_inst_t *uart, const uint8_t *data, size_t len) { uart_write_blocking(uart, data, len); }
+// True until the last stop bit has left the shift register
+static inline bool modbus_hal_uart_is_busy(uart_inst_t *uart) { return uart_get_hw(uart)->fr & UART_UARTFR_BUSY_BITS; }
+static inline uint modbus_hal_uart_get_index(uart_inst_t *uart) { return uart_get_index(uart); }
+static inline void modbus_hal_uart_set_irq_enables(uart_inst_t *uart, bool rx, bool tx) { uart_set_irq_enables(uart, rx, tx); }
+static inline void modbus_hal_uart_set_irq_handler(uart_inst_t *uart, modbus_hal_irq_handler_t handler) {
+  uint irq_num = uart_get_index(uart) == 0 ? UART0_IRQ : UART1_IRQ;
+  irq_set_exclusive_handler(irq_num, handler);
+  irq_set_enabled(irq_num, true);
+}
+
+static inline void modbus_hal_de_init(uint pin) {
+  gpio_init(pin);
+  gpio_set_dir(pin, GPIO_OUT);
+  gpio_put(pin, 0);
+}
+static inline void modbus_hal_de_put(uint pin, bool value) { gpio_put(pin, value); }
+
+static inline uint64_t   modbus_hal_time_us_64() { return time_us_64(); }
+static inline uint32_t   modbus_hal_time_us_32() { return time_us_32(); }
+static inline void       modbus_hal_sleep_us(uint64_t us) { sleep_us(us); }
+static inline void       modbus_hal_sleep_ms(uint32_t ms) { sleep_ms(ms); }
+static inline void       modbus_hal_idle() { tight_loop_contents(); }
+static inline alarm_id_t modbus_hal_add_alarm_in_us(uint64_t us, modbus_hal_alarm_cb_t callback, void *user_data) {
+  return add_alarm_in_us(us, callback, user_data, true);
+}
+static inline void modbus_hal_cancel_alarm(alarm_id_t id) { cancel_alarm(id); }
+#endif
+
+#endif
@@ -1,108 +1,536 @@
 #include "modbus_master.h"
+
+#include <algorithm>
+
+ModbusMaster *ModbusMaster::instances[2] = {nullptr, nullptr};
+#if MODBUS_HAL_PIO == 1
+ModbusMaster *ModbusMaster::pio_instances[2] = {nullptr, nullptr};
+#endif
+
+void ModbusMaster::init() {
+  modbus_hal_uart_init(uart_id, tx_pin, rx_pin, baud_rate, data_bits, stop_bits, parity);
+  modbus_hal_de_init(de_re_pin);
+  update_char_timing();
+
+  // Every received byte goes through the IRQ, either into the active transaction or into rx_ring
+  instances[modbus_hal_uart_get_index(uart_id)] = this;
+  modbus_hal_uart_set_irq_handler(uart_id, uart_irq_handler);
+  modbus_hal_uart_set_irq_enables(uart_id, true, false);
+}
+
+#if MODBUS_HAL_PIO == 1
+bool ModbusMaster::init_pio(PIO pio) {
+  if (data_bits != 8 || parity != UART_PARITY_NONE || stop_bits < 1 || stop_bits > 32) {
+    init();
+    return false;
+  }
+
+  // Both programs have to live in the same PIO so one IRQ line serves the port
+  if (!pio_can_add_program(pio, &rs485_tx_program) || !pio_can_add_program(pio, &rs485_rx_program)) {
+    init();
+    return false;
+  }
+  int tx = pio_claim_unused_sm(pio, false);
+  int rx = pio_claim_unused_sm(pio, false);
+  // No completion IRQ, the TX program's IRQ marks the end of a frame
+  int ch = dma_manager_claim(false);
+  if (tx < 0 || rx < 0 || ch < 0) {
+    if (tx >= 0)
+      pio_sm_unclaim(pio, tx);
+    if (rx >= 0)
+      pio_sm_unclaim(pio, rx);
+    if (ch >= 0)
+      dma_manager_unclaim(ch);
+    init();
+    return false;
+  }
+
+  this->pio  = pio;
+  pio_backend = true;
+  tx_sm       = tx;
+  rx_sm       = rx;
+  tx_dma      = ch;
+
+  tx_offset      = pio_add_program(pio, &rs485_tx_program);
+  uint rx_offset = pio_add_program(pio, &rs485_rx_program);
+  rs485_tx_program_init(pio, tx_sm, tx_offset, tx_pin, de_re_pin, baud_rate, stop_bits);
+  rs485_rx_program_init(pio, rx_sm, rx_offset, rx_pin, baud_rate);
+  // The TX program raises its IRQ once on start, that is not the end of a frame
+  pio_interrupt_clear(pio, tx_sm);
+  update_char_timing();
+
+  // Frames are pushed by DMA, the TX program paces them out byte by byte
+  tx_dma_config = dma_channel_get_default_config(tx_dma);
+  channel_config_set_transfer_data_size(&tx_dma_config, DMA_SIZE_8);
+  channel_config_set_read_increment(&tx_dma_config, true);
+  channel_config_set_write_increment(&tx_dma_config, false);
+  channel_config_set_dreq(&tx_dma_config, pio_get_dreq(pio, tx_sm, true));
+
+  pio_instances[pio_get_index(pio)] = this;
+  uint irq_num                      = pio_get_index(pio) == 0 ? PIO0_IRQ_0 : PIO1_IRQ_0;
+  pio_set_irq0_source_enabled(pio, (pio_interrupt_source) (pis_interrupt0 + tx_sm), true);
+  pio_set_irq0_source_enabled(pio, (pio_interrupt_source) (pis_sm0_rx_fifo_not_empty + rx_sm), true);
+  irq_add_shared_handler(irq_num, pio_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(irq_num, true);
+  return true;
+}
+#endif
+
+void ModbusMaster::change_stop_bits(uint stop_bits) {
+  this->stop_bits                    = stop_bits;
+  profiles[active_profile].stop_bits = stop_bits;
+#if MODBUS_HAL_PIO == 1
+  if (pio_backend) {
+    // The extra stop bit count only gets loaded at init, so restart the TX program
+    pio_sm_set_enabled(pio, tx_sm, false);
+    rs485_tx_program_init(pio, tx_sm, tx_offset, tx_pin, de_re_pin, baud_rate, stop_bits);
+    pio_interrupt_clear(pio, tx_sm);
+    update_char_timing();
+    return;
+  }
+#endif
+  modbus_hal_uart_set_format(uart_id, data_bits, stop_bits, parity);
+  update_char_timing();
+}
+
+void ModbusMaster::change_baud_rate(uint baud_rate) {
+  this->baud_rate                    = baud_rate;
+  profiles[active_profile].baud_rate = baud_rate;
+#if MODBUS_HAL_PIO == 1
+  if (pio_backend) {
+    float div = (float) clock_get_hz(clk_sys) / (8 * baud_rate);
+    pio_sm_set_clkdiv(pio, tx_sm, div);
+    pio_sm_set_clkdiv(pio, rx_sm, div);
+    update_char_timing();
+    return;
+  }
+#endif
+  modbus_hal_uart_set_baudrate(uart_id, baud_rate);
+  update_char_timing();
+}
+
+int ModbusMaster::add_profile(const modbus_serial_profile_t &profile) {
+  if (profile_count >= MAX_SERIAL_PROFILES)
+    return -1;
+  profiles[profile_count] = profile;
+  return profile_count++;
+}
+
+bool ModbusMaster::bind_profile(uint8_t slave_addr, int profile) {
+  if (profile < 0 || profile >= (int) profile_count)
+    return false;
+  for (uint i = 0; i < bindings_count; i++) {
+    if (bindings[i].slave_addr == slave_addr) {
+      bindings[i].profile = profile;
+      return true;
+    }
+  }
+  if (bindings_count >= MAX_PROFILE_BINDINGS)
+    return false;
+  bindings[bindings_count++] = {slave_addr, (uint8_t) profile};
+  return true;
+}
+
+int ModbusMaster::get_profile(uint8_t slave_addr) {
+  for (uint i = 0; i < bindings_count; i++) {
+    if (bindings[i].slave_addr == slave_addr)
+      return bindings[i].profile;
+  }
+  return 0;
+}
+
+bool ModbusMaster::select_profile(int profile) {
+  if (profile == active_profile)
+    return true;
+  const modbus_serial_profile_t &next = profiles[profile];
+  if (pio_backend && (next.data_bits != 8 || next.parity != UART_PARITY_NONE))
+    return false;
+
+  bool baud_changed   = next.baud_rate != baud_rate;
+  bool format_changed = next.data_bits != data_bits || next.parity != parity || next.stop_bits != stop_bits;
+  active_profile      = profile;
+
+  // Only touch the peripheral for what actually differs, profiles often share the baud rate
+  if (baud_changed || format_changed)
+    profile_switches++;
+  if (baud_changed)
+    change_baud_rate(next.baud_rate);
+  if (format_changed) {
+    data_bits = next.data_bits;
+    parity    = next.parity;
+    change_stop_bits(next.stop_bits);
+  }
+  update_char_timing();
+  return true;
+}
+
+int ModbusMaster::build_frame(uint8_t slave_addr, const modbus_pdu_t &pdu) {
+  frame[0] = slave_addr;
+  for (size_t i = 0; i < pdu.len; i++) frame[1 + i] = pdu.data[i];
+  uint16_t crc       = modbus_crc(frame, pdu.len + 1);
+  frame[pdu.len + 1] = crc & 0xFF;
+  frame[pdu.len + 2] = crc >> 8;
+  return pdu.len + 3;
+}
+
 void ModbusMaster::send_message(uint8_t slave_addr, modbus_function_code_t function, uint16_t reg_addr, uint16_t reg_count, uint pre_tx_delay,
                                 uint post_tx_delay) {
-  while (uart_is_readable(uart_id)) {
-    int c = uart_getc(uart_id);
-  }
-
-  int frame_size = 8;
-  if (reg_count == 0xFFFF) {
-    frame_size = 4;
-    frame[0]   = slave_addr;
-    frame[1]   = function;
-    // Calculate CRC
-    uint16_t crc = modbus_crc(frame, 2);
-    frame[2]     = crc & 0xFF;
-    frame[3]     = crc >> 8;
-  } else if (reg_count == 0xF170) {
-    frame_size = 6;
-    frame[0]   = slave_addr;
-    frame[1]   = function;
-    frame[2]   = 0x37;
-    frame[3]   = 0x21;
-    // Calculate CRC
-    uint16_t crc = modbus_crc(frame, 4);
-    frame[4]     = crc & 0xFF;
-    frame[5]     = crc >> 8;
+  send_pdu(slave_addr, modbus_pdu_t::address_value(function, reg_addr, reg_count), pre_tx_delay, post_tx_delay);
+}
 
-  } else {
-    frame_size = 8;
-    frame[0]   = slave_addr;
-    frame[1]   = function;
-    frame[2]   = reg_addr >> 8;     // High byte
-    frame[3]   = reg_addr & 0xFF;   // Low byte
-    frame[4]   = reg_count >> 8;    // High byte
-    frame[5]   = reg_count & 0xFF;  // Low byte
+bool ModbusMaster::send_pdu(uint8_t slave_addr, const modbus_pdu_t &pdu, uint pre_tx_delay, uint post_tx_delay) {
+  // The blocking API shares the port, frame and ring with the async engine, it must not touch them mid-transaction
+  if (is_busy() || pdu.len == 0 || pdu.overflow)
+    return false;
 
-    // Calculate CRC
-    uint16_t crc = modbus_crc(frame, 6);
-    frame[6]     = crc & 0xFF;
-    frame[7]     = crc >> 8;
+  if (!select_profile(get_profile(slave_addr)))
+    return false;
+  rx_ring_flush();
 
+  int frame_size = build_frame(slave_addr, pdu);
+  if (profiles[active_profile].turnaround_us)
+    modbus_hal_sleep_us(profiles[active_profile].turnaround_us);
+  if (capture)
+    capture->record(Capture_TX, frame, frame_size, modbus_hal_time_us_32());
+
+#if MODBUS_HAL_PIO == 1
+  if (pio_backend) {
+    // DE is driven by the TX program, no guard delays needed
+    tx_done = false;
+    for (int i = 0; i < frame_size; i++) pio_sm_put_blocking(pio, tx_sm, frame[i]);
+    while (!tx_done) modbus_hal_idle();
+    return true;
   }
+#endif
 
   // Enable transmit mode
-  gpio_put(de_re_pin, 1);
-  sleep_ms(pre_tx_delay);
-  uart_write_blocking(uart_id, frame, frame_size);
-  // Wait for transmission to complete
-  sleep_ms(post_tx_delay);
+  modbus_hal_de_put(de_re_pin, 1);
+  modbus_hal_sleep_ms(pre_tx_delay);
+  modbus_hal_uart_write_blocking(uart_id, frame, frame_size);
+  // Wait for transmission to complete, the write returns with up to two characters still in the UART
+  while (modbus_hal_uart_is_busy(uart_id)) modbus_hal_idle();
+  modbus_hal_sleep_ms(post_tx_delay);
   // Disable transmit mode
-  gpio_put(de_re_pin, 0);
+  modbus_hal_de_put(de_re_pin, 0);
+  return true;
 }
 bool ModbusMaster::receive_response(uint8_t *resp, size_t len, uint32_t timeout_ms, size_t max_buffer_size) {
-  if (len < 2 || len > max_buffer_size) {
+  if (is_busy() || len < 2 || len > max_buffer_size) {
     return false;
   }
 
-  uint32_t start_time = to_ms_since_boot(get_absolute_time());
+  uint64_t start_time = modbus_hal_time_us_64();
   size_t   index      = 0;
+  size_t   expected   = len;
+  uint16_t crc        = MODBUS_CRC_INIT;
 
-  while ((to_ms_since_boot(get_absolute_time()) - start_time) < timeout_ms) {
-    if (uart_is_readable(uart_id)) {
+  while (modbus_hal_time_us_64() - start_time < (uint64_t) timeout_ms * 1000) {
+    if (rx_tail != rx_head) {
       if (index >= max_buffer_size)
         return false;
 
-      // Replace blocking read with single-byte non-blocking read
-      int c = uart_getc(uart_id);
-      if (c != PICO_ERROR_TIMEOUT) {
-        resp[index] = (uint8_t) c;
-        if (++index >= len)
-          break;
-      }
+      resp[index] = rx_ring[rx_tail];
+      rx_tail     = (rx_tail + 1) & (RX_RING_SIZE - 1);
+      crc         = modbus_crc_update(crc, resp[index]);
+      // An exception or a shorter read reply ends the wait as soon as it is complete
+      expected = std::min(expected_response_len(resp, ++index, len), max_buffer_size);
+      if (index >= expected)
+        break;
+    } else {
+      modbus_hal_idle();
     }
-    sleep_us(100);
   }
 
-  if (index == len) {
-    uint16_t crc = modbus_crc(resp, len - 2);
-    if (resp[len - 2] == (crc & 0xFF) && resp[len - 1] == (crc >> 8)) {
-      return true;
+  // CRC over the frame including its own CRC bytes is zero when intact
+  return index == expected && crc == 0;
+}
+
+bool ModbusMaster::submit(modbus_transaction_t &transaction, uint8_t slave_addr, modbus_function_code_t function, uint16_t reg_addr,
+                          uint16_t reg_count, uint8_t *resp, size_t resp_len, uint32_t timeout_ms) {
+  return submit(transaction, slave_addr, modbus_pdu_t::address_value(function, reg_addr, reg_count), resp, resp_len, timeout_ms);
+}
+
+bool ModbusMaster::submit(modbus_transaction_t &transaction, uint8_t slave_addr, const modbus_pdu_t &pdu, uint8_t *resp, size_t resp_len,
+                          uint32_t timeout_ms) {
+  if (engine_state != Engine_Idle || resp_len < 2 || resp_len > MAX_RESP_SIZE || pdu.len == 0 || pdu.overflow)
+    return false;
+  if (!select_profile(get_profile(slave_addr)))
+    return false;
+
+  transaction.resp           = resp;
+  transaction.resp_len       = resp_len;
+  transaction.timeout_ms     = timeout_ms;
+  transaction.received       = 0;
+  transaction.status         = TRANSACTION_PENDING;
+  transaction.exception_code = 0;
+  transaction.submitted_us   = modbus_hal_time_us_64();
+  transaction.completed_us   = 0;
+
+  tx_len        = build_frame(slave_addr, pdu);
+  tx_index      = 0;
+  active        = &transaction;
+  rx_crc        = MODBUS_CRC_INIT;
+  rx_expected   = resp_len;
+  rx_timeout_us = get_response_timeout_us(slave_addr, timeout_ms);
+  rx_ring_flush();
+
+  // Hold the bus idle for one inter-frame gap before the first start bit
+  engine_state = Engine_Pre_TX;
+  if (!pio_backend)
+    modbus_hal_de_put(de_re_pin, 1);
+  schedule(frame_gap_us + profiles[active_profile].turnaround_us);
+  return true;
+}
+
+size_t ModbusMaster::expected_response_len(const uint8_t *resp, size_t received, size_t resp_len) {
+  if (received < 2)
+    return resp_len;
+  uint8_t function = resp[1];
+  if (function & 0x80)
+    return MODBUS_EXCEPTION_LEN;
+  switch (function) {
+  case READ_COILS:
+  case READ_DISCRETE_INPUTS:
+  case READ_HOLDING_REGISTERS:
+  case READ_INPUT_REGISTERS:
+  case READ_WRITE_MULTIPLE_REGISTERS:
+    // Address, function, byte count, data, CRC
+    return received < 3 ? resp_len : std::min<size_t>(5 + resp[2], MAX_RESP_SIZE);
+  case WRITE_SINGLE_COIL:
+  case WRITE_SINGLE_REGISTER:
+  case WRITE_MULTIPLE_COILS:
+  case WRITE_MULTIPLE_REGISTERS:
+    return 8;
+  default:
+    return resp_len;
+  }
+}
+
+void ModbusMaster::set_adaptive_timeout(bool enable, uint32_t margin_us, uint min_samples) {
+  adaptive_timeout     = enable;
+  adaptive_margin_us   = margin_us;
+  adaptive_min_samples = std::min<uint>(std::max<uint>(min_samples, 1), RTT_WINDOW);
+}
+
+ModbusMaster::rtt_history_t *ModbusMaster::get_rtt_history(uint8_t slave_addr, bool create) {
+  for (uint i = 0; i < rtt_count; i++) {
+    if (rtt[i].slave_addr == slave_addr)
+      return &rtt[i];
+  }
+  if (!create || rtt_count >= MAX_RTT_SLAVES)
+    return nullptr;
+  rtt_history_t *history = &rtt[rtt_count++];
+  history->slave_addr    = slave_addr;
+  history->count         = 0;
+  history->head          = 0;
+  return history;
+}
+
+void ModbusMaster::record_rtt(uint8_t slave_addr, uint32_t rtt_us) {
+  rtt_history_t *history = get_rtt_history(slave_addr, true);
+  if (!history)
+    return;
+  history->samples_us[history->head] = rtt_us;
+  history->head                      = (history->head + 1) % RTT_WINDOW;
+  if (history->count < RTT_WINDOW)
+    history->count++;
+}
+
+uint32_t ModbusMaster::get_response_timeout_us(uint8_t slave_addr, uint32_t timeout_ms) {
+  uint32_t       limit_us = timeout_ms * 1000;
+  rtt_history_t *history  = get_rtt_history(slave_addr, false);
+  if (!adaptive_timeout || !history || history->count < adaptive_min_samples)
+    return limit_us;
+
+  // Works on a copy, a sample landing from the IRQ mid-copy only skews a single value
+  uint32_t samples[RTT_WINDOW];
+  uint     count = history->count;
+  std::copy(history->samples_us, history->samples_us + count, samples);
+  uint p99 = (count * 99 + 99) / 100 - 1;
+  std::nth_element(samples, samples + p99, samples + count);
+  return std::min(samples[p99] + adaptive_margin_us, limit_us);
+}
+
+void ModbusMaster::update_char_timing() {
+  uint bits_per_char = 1 + data_bits + (parity == UART_PARITY_NONE ? 0 : 1) + stop_bits;
+  char_time_us       = (bits_per_char * 1000000 + baud_rate - 1) / baud_rate;
+  // Modbus RTU fixes t3.5 to 1.75ms above 19200 baud
+  frame_gap_us = baud_rate > 19200 ? 1750 : (char_time_us * 7 + 1) / 2;
+  if (profiles[active_profile].frame_gap_us)
+    frame_gap_us = profiles[active_profile].frame_gap_us;
+}
+
+void ModbusMaster::rx_ring_flush() { rx_tail = rx_head; }
+
+void ModbusMaster::schedule(uint64_t delay_us) {
+  if (alarm > 0)
+    modbus_hal_cancel_alarm(alarm);
+  alarm = modbus_hal_add_alarm_in_us(delay_us, alarm_handler, this);
+}
+
+void ModbusMaster::start_tx() {
+  engine_state = Engine_TX;
+  if (capture)
+    capture->record(Capture_TX, frame, tx_len, modbus_hal_time_us_32());
+#if MODBUS_HAL_PIO == 1
+  if (pio_backend) {
+    // The TX program raises its IRQ after the last stop bit, see on_tx_done
+    tx_done = false;
+    dma_channel_configure(tx_dma, &tx_dma_config, &pio->txf[tx_sm], frame, tx_len, true);
+    return;
+  }
+#endif
+  // The TX interrupt is level triggered on an empty holding register, so it fires right away
+  modbus_hal_uart_set_irq_enables(uart_id, true, true);
+}
+
+void ModbusMaster::finish(modbus_transaction_status_t status) {
+  if (alarm > 0) {
+    modbus_hal_cancel_alarm(alarm);
+    alarm = 0;
+  }
+  modbus_transaction_t *transaction = active;
+  active                            = nullptr;
+  engine_state                      = Engine_Idle;
+
+  transaction->completed_us = modbus_hal_time_us_64();
+  if (status == TRANSACTION_DONE && (transaction->resp[1] & 0x80)) {
+    status                      = TRANSACTION_EXCEPTION;
+    transaction->exception_code = transaction->resp[2];
+  }
+  // Only intact replies say anything about how fast the slave answers
+  if (status == TRANSACTION_DONE || status == TRANSACTION_EXCEPTION)
+    record_rtt(frame[0], transaction->completed_us - tx_end_us);
+  transaction->status = status;
+  if (capture) {
+    uint8_t event = status;
+    capture->record(Capture_Event, &event, 1, (uint32_t) transaction->completed_us);
+  }
+  if (transaction->on_complete)
+    transaction->on_complete(transaction);
+}
+
+void ModbusMaster::on_rx_byte(uint8_t c) {
+  if (capture)
+    capture->record_rx(c, modbus_hal_time_us_32(), frame_gap_us);
+  if (engine_state != Engine_RX) {
+    uint16_t next = (rx_head + 1) & (RX_RING_SIZE - 1);
+    if (next != rx_tail) {
+      rx_ring[rx_head] = c;
+      rx_head          = next;
     }
+    return;
+  }
+
+  modbus_transaction_t *transaction = active;
+  if (transaction->received < std::max<size_t>(transaction->resp_len, MODBUS_EXCEPTION_LEN)) {
+    transaction->resp[transaction->received++] = c;
+    rx_crc                                     = modbus_crc_update(rx_crc, c);
+    rx_expected                                = expected_response_len(transaction->resp, transaction->received, transaction->resp_len);
+  }
+
+  if (transaction->received >= rx_expected) {
+    finish(rx_crc == 0 ? TRANSACTION_DONE : TRANSACTION_INVALID_CRC);
+  } else {
+    // Restart the silence detector, the frame ends after t3.5 without a new byte
+    schedule(frame_gap_us);
   }
-  return false;
 }
 
-// Modbus CRC calculation
-uint16_t ModbusMaster::modbus_crc(uint8_t *buf, int len) {
-  uint16_t crc = 0xFFFF;
-
-  for (int pos = 0; pos < len; pos++) {
-    crc ^= (uint16_t) buf[pos];
-
-    for (int i = 8; i != 0; i--) {
-      if ((crc & 0x0001) != 0) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
+void ModbusMaster::on_rx_start() {
+  // Round trips and the response timeout are both counted from the moment the bus is released
+  tx_end_us    = modbus_hal_time_us_64();
+  engine_state = Engine_RX;
+}
+
+void ModbusMaster::on_tx_done() {
+  tx_done = true;
+  if (engine_state != Engine_TX)
+    return;
+  // DE is already released by the TX program, so there is no drain phase to wait out
+  on_rx_start();
+  schedule(rx_timeout_us);
+}
+
+#if MODBUS_HAL_PIO == 1
+void ModbusMaster::on_pio_irq() {
+  if (pio_interrupt_get(pio, tx_sm)) {
+    pio_interrupt_clear(pio, tx_sm);
+    on_tx_done();
+  }
+  // The RX program leaves the byte in the top 8 bits of the FIFO word
+  while (!pio_sm_is_rx_fifo_empty(pio, rx_sm)) on_rx_byte((uint8_t) (pio_sm_get(pio, rx_sm) >> 24));
+}
+#endif
+
+void ModbusMaster::on_uart_irq() {
+  while (modbus_hal_uart_is_readable(uart_id)) on_rx_byte(modbus_hal_uart_getc(uart_id));
+
+  if (engine_state == Engine_TX) {
+    while (tx_index < tx_len && modbus_hal_uart_is_writable(uart_id)) modbus_hal_uart_putc(uart_id, frame[tx_index++]);
+    if (tx_index == tx_len) {
+      modbus_hal_uart_set_irq_enables(uart_id, true, false);
+      engine_state = Engine_Drain;
+      schedule(char_time_us);
     }
   }
-  return crc;
 }
 
+int64_t ModbusMaster::on_alarm() {
+  switch (engine_state) {
+  case Engine_Pre_TX:
+    alarm = 0;
+    start_tx();
+    return 0;
+  case Engine_Drain:
+    // Keep DE asserted until the final stop bit has left the shift register
+    if (modbus_hal_uart_is_busy(uart_id))
+      return char_time_us;
+    modbus_hal_de_put(de_re_pin, 0);
+    on_rx_start();
+    // Reuse this alarm as the response timeout
+    return rx_timeout_us;
+  case Engine_RX: {
+    // Fired either as the response timeout or as the t3.5 gap after a short frame,
+    // a complete short frame is checked by finish() for being an exception reply
+    alarm      = 0;
+    size_t len = active->received;
+    if (len == 0)
+      finish(TRANSACTION_TIMEOUT);
+    else if (len >= 4 && rx_crc == 0)
+      finish(TRANSACTION_DONE);
+    else
+      finish(TRANSACTION_INVALID_CRC);
+    return 0;
+  }
+  default:
+    alarm = 0;
+    return 0;
+  }
+}
+
+void ModbusMaster::uart_irq_handler() {
+  for (ModbusMaster *instance : instances) {
+    if (instance)
+      instance->on_uart_irq();
+  }
+}
+
+#if MODBUS_HAL_PIO == 1
+void ModbusMaster::pio_irq_handler() {
+  for (ModbusMaster *instance : pio_instances) {
+    if (instance)
+      instance->on_pio_irq();
+  }
+}
+#endif
+
+int64_t ModbusMaster::alarm_handler(alarm_id_t id, void *user_data) { return static_cast<ModbusMaster *>(user_data)->on_alarm(); }
+
+// Modbus CRC calculation
+uint16_t ModbusMaster::modbus_crc(uint8_t *buf, int len) { return modbus_crc16(buf, len); }
+
 bool ModbusMaster::validate_crc(uint8_t *buf, int len, uint16_t crc) {
   uint16_t calculated_crc = modbus_crc(buf, len);
   return (calculated_crc == crc);
-}
\ No newline at end of file
+}
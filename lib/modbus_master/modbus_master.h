@@ -2,23 +2,76 @@
 #define MODBUS_MASTER_H
 #include <stdio.h>
 
-#include "hardware/gpio.h"
-#include "hardware/uart.h"
-#include "pico/stdlib.h"
+#include "modbus_capture.h"
+#include "modbus_crc.h"
+#include "modbus_hal.h"
+#include "modbus_pdu.h"
 
 #define MAX_RESP_SIZE 256U
+#define RX_RING_SIZE 256U  // Must be a power of two
+#define MAX_SERIAL_PROFILES 4U
+#define MAX_PROFILE_BINDINGS 8U
+#define MAX_RTT_SLAVES 8U
+#define RTT_WINDOW 64U  // Round-trip samples kept per slave for the adaptive timeout
+#define MODBUS_EXCEPTION_LEN 5U
 
 typedef enum {
-  READ_COILS               = 0x01,
-  READ_DISCRETE_INPUTS     = 0x02,
-  READ_HOLDING_REGISTERS   = 0x03,
-  READ_INPUT_REGISTERS     = 0x04,
-  WRITE_SINGLE_COIL        = 0x05,
-  WRITE_SINGLE_REGISTER    = 0x06,
-  WRITE_MULTIPLE_COILS     = 0x0F,
-  WRITE_MULTIPLE_REGISTERS = 0x10
+  READ_COILS                    = 0x01,
+  READ_DISCRETE_INPUTS          = 0x02,
+  READ_HOLDING_REGISTERS        = 0x03,
+  READ_INPUT_REGISTERS          = 0x04,
+  WRITE_SINGLE_COIL             = 0x05,
+  WRITE_SINGLE_REGISTER         = 0x06,
+  WRITE_MULTIPLE_COILS          = 0x0F,
+  WRITE_MULTIPLE_REGISTERS      = 0x10,
+  READ_WRITE_MULTIPLE_REGISTERS = 0x17,
 } modbus_function_code_t;
 
+typedef enum {
+  TRANSACTION_IDLE,
+  TRANSACTION_PENDING,
+  TRANSACTION_DONE,
+  TRANSACTION_TIMEOUT,
+  TRANSACTION_INVALID_CRC,
+  TRANSACTION_EXCEPTION,  // Valid exception reply, the code is in exception_code
+} modbus_transaction_status_t;
+
+struct modbus_transaction_t;
+typedef void (*modbus_complete_cb_t)(modbus_transaction_t *transaction);
+
+/**
+ * @brief One request/response exchange handled by the interrupt driven engine.
+ * The caller owns the storage, it must stay alive until status leaves TRANSACTION_PENDING.
+ * Either poll status from the main loop or attach on_complete, which runs in IRQ context.
+ * resp_len is the length of the normal reply, resp must also have room for a 5 byte exception reply.
+ */
+struct modbus_transaction_t {
+  uint8_t                             *resp           = nullptr;
+  size_t                               resp_len       = 0;
+  uint32_t                             timeout_ms     = 1000;
+  volatile size_t                      received       = 0;
+  volatile modbus_transaction_status_t status         = TRANSACTION_IDLE;
+  uint8_t                              exception_code = 0;
+  modbus_complete_cb_t                 on_complete    = nullptr;
+  void                                *user_data      = nullptr;
+  uint64_t                             submitted_us   = 0;
+  uint64_t                             completed_us   = 0;
+};
+
+/**
+ * @brief Serial framing of one kind of slave on the bus
+ * frame_gap_us 0 uses t3.5 computed from the framing. turnaround_us is extra silence held before every request
+ * to a slave using this profile, for devices that are slow to re-arm their receiver after the previous frame.
+ */
+struct modbus_serial_profile_t {
+  uint          baud_rate     = 9600;
+  uint          data_bits     = 8;
+  uart_parity_t parity        = UART_PARITY_NONE;
+  uint          stop_bits     = 1;
+  uint32_t      frame_gap_us  = 0;
+  uint32_t      turnaround_us = 0;
+};
+
 class ModbusMaster {
  public:
   ModbusMaster(uint8_t de_re_pin, uint8_t rx_pin, uint8_t tx_pin, uart_inst_t *uart_id, uint baud_rate, uint data_bits, uint stop_bits,
@@ -31,36 +84,100 @@ class ModbusMaster {
     this->data_bits = data_bits;
     this->stop_bits = stop_bits;
     this->parity    = parity;
+
+    // Profile 0 is the constructor framing, every slave uses it until bound to another one
+    profiles[0].baud_rate = baud_rate;
+    profiles[0].data_bits = data_bits;
+    profiles[0].stop_bits = stop_bits;
+    profiles[0].parity    = parity;
   }
-  void init() {
-    uart_init(uart_id, baud_rate);
+  void init();
 
-    gpio_init(de_re_pin);
-    gpio_set_dir(de_re_pin, GPIO_OUT);
-    gpio_put(de_re_pin, 0);
+#if MODBUS_HAL_PIO == 1
+  /**
+   * @brief Alternative to init() that runs the port on two PIO state machines instead of the hardware UART
+   * DE/RE becomes a side-set pin, asserted with the first start bit and released right after the last stop bit,
+   * so pre_tx_delay/post_tx_delay are ignored. Only 8 data bits without parity are supported.
+   * @return false if the framing is unsupported or the PIO has no room, the hardware UART is used instead
+   */
+  bool init_pio(PIO pio);
+#endif
 
-    gpio_set_function(rx_pin, GPIO_FUNC_UART);
-    gpio_set_function(tx_pin, GPIO_FUNC_UART);
+  void change_stop_bits(uint stop_bits);
+  void change_baud_rate(uint baud_rate);
 
-    uart_set_hw_flow(uart_id, false, false);
-    uart_set_format(uart_id, data_bits, stop_bits, parity);
-    uart_set_fifo_enabled(uart_id, false);
-  }
+  /**
+   * @brief Register a serial profile
+   * @return Profile index for bind_profile(), -1 if the table is full
+   */
+  int add_profile(const modbus_serial_profile_t &profile);
 
-  void change_stop_bits(uint stop_bits) {
-    this->stop_bits = stop_bits;
-    uart_set_format(uart_id, data_bits, stop_bits, parity);
-  }
+  /**
+   * @brief Make every transaction to slave_addr use the given profile
+   * The port is only reconfigured when a transaction targets a different profile than the previous one.
+   */
+  bool bind_profile(uint8_t slave_addr, int profile);
+  int  get_profile(uint8_t slave_addr);
+  int  get_active_profile() { return active_profile; }
+  // Number of times the port actually had to be reconfigured
+  uint get_profile_switches() { return profile_switches; }
 
+  // Blocking send of the standard request: function, register address and count (or value for single writes), dropped while is_busy()
   void
   send_message(uint8_t slave_addr, modbus_function_code_t function, uint16_t reg_addr, uint16_t reg_count, uint pre_tx_delay, uint post_tx_delay);
 
+  /**
+   * @brief Blocking send of an arbitrary PDU, e.g. a multiple write or a vendor function code
+   * @return false if the PDU is empty or overflowed, or while an async transaction is in flight (is_busy())
+   */
+  bool send_pdu(uint8_t slave_addr, const modbus_pdu_t &pdu, uint pre_tx_delay, uint post_tx_delay);
+
+  // Blocking read of a reply of len bytes, false on timeout, bad CRC or while an async transaction is in flight (is_busy())
   bool     receive_response(uint8_t *resp, size_t len, uint32_t timeout_ms, size_t max_buffer_size = MAX_RESP_SIZE);
   uint16_t modbus_crc(uint8_t *buf, int len);
   bool     validate_crc(uint8_t *buf, int len, uint16_t crc);
   uint8_t* get_response_buffer() { return resp_buf; }
 
+  /**
+   * @brief Start a non-blocking transaction, the reply is written into resp
+   * @param transaction Caller owned transaction, status becomes TRANSACTION_PENDING until the reply is in
+   * @return false if another transaction is still in flight
+   */
+  bool submit(modbus_transaction_t &transaction, uint8_t slave_addr, modbus_function_code_t function, uint16_t reg_addr, uint16_t reg_count,
+              uint8_t *resp, size_t resp_len, uint32_t timeout_ms);
+
+  // Same as above with an arbitrary PDU, also false if the PDU is empty or overflowed
+  bool submit(modbus_transaction_t &transaction, uint8_t slave_addr, const modbus_pdu_t &pdu, uint8_t *resp, size_t resp_len, uint32_t timeout_ms);
+
+  bool is_busy() { return engine_state != Engine_Idle; }
+
+  // Record bus traffic into capture while it is enabled, nullptr detaches it
+  void set_capture(ModbusCapture *capture) { this->capture = capture; }
+
+  /**
+   * @brief Shrink the async response timeout of each slave to its measured round trip
+   * Once a slave has min_samples valid replies, the timeout becomes the p99 of the last RTT_WINDOW round trips
+   * plus margin_us. The timeout_ms passed to submit() stays the upper bound.
+   */
+  void     set_adaptive_timeout(bool enable, uint32_t margin_us = 5000, uint min_samples = 16);
+  uint32_t get_response_timeout_us(uint8_t slave_addr, uint32_t timeout_ms);
+
+  /**
+   * @brief Length of the reply being received, as far as the bytes seen so far tell
+   * Exception replies are 5 bytes, reads (and 0x17) carry their byte count in the third byte and the standard
+   * writes echo 8 bytes. Anything else, e.g. vendor function codes, falls back to the caller's resp_len.
+   */
+  static size_t expected_response_len(const uint8_t *resp, size_t received, size_t resp_len);
+
  private:
+  typedef enum {
+    Engine_Idle,
+    Engine_Pre_TX,
+    Engine_TX,
+    Engine_Drain,
+    Engine_RX,
+  } engine_state_t;
+
   uint8_t       frame[256];
   uint8_t       resp_buf[MAX_RESP_SIZE];
   uint8_t       de_re_pin;
@@ -71,6 +188,89 @@ class ModbusMaster {
   uint          data_bits;
   uint          stop_bits;
   uart_parity_t parity;
+
+  // Interrupt driven engine state
+  volatile engine_state_t        engine_state  = Engine_Idle;
+  modbus_transaction_t *volatile active        = nullptr;
+  alarm_id_t                     alarm         = 0;
+  size_t                         tx_len        = 0;
+  size_t                         tx_index      = 0;
+  uint32_t                       char_time_us  = 0;
+  uint32_t                       frame_gap_us  = 0;
+  uint16_t                       rx_crc        = MODBUS_CRC_INIT;  // Updated per byte, zero at the end of an intact frame
+  size_t                         rx_expected   = 0;
+  uint32_t                       rx_timeout_us = 0;
+  uint64_t                       tx_end_us     = 0;
+
+  // Round trip history for the adaptive timeout, written from IRQ context by finish()
+  struct rtt_history_t {
+    uint8_t  slave_addr;
+    uint16_t count;
+    uint16_t head;
+    uint32_t samples_us[RTT_WINDOW];
+  };
+  rtt_history_t rtt[MAX_RTT_SLAVES];
+  uint          rtt_count            = 0;
+  bool          adaptive_timeout     = false;
+  uint32_t      adaptive_margin_us   = 5000;
+  uint          adaptive_min_samples = 16;
+
+  // Serial profiles, switched lazily by select_profile
+  modbus_serial_profile_t profiles[MAX_SERIAL_PROFILES];
+  uint                    profile_count    = 1;
+  int                     active_profile   = 0;
+  uint                    profile_switches = 0;
+  struct {
+    uint8_t slave_addr;
+    uint8_t profile;
+  } bindings[MAX_PROFILE_BINDINGS];
+  uint bindings_count = 0;
+
+  ModbusCapture *capture = nullptr;
+
+  // PIO backend, pio_backend stays false when the hardware UART is used
+  bool          pio_backend = false;
+  volatile bool tx_done     = false;
+#if MODBUS_HAL_PIO == 1
+  PIO                pio    = nullptr;
+  uint               tx_sm  = 0;
+  uint               rx_sm  = 0;
+  uint               tx_offset;
+  int                tx_dma = -1;
+  dma_channel_config tx_dma_config;
+#endif
+
+  // Bytes received outside of an async transaction, consumed by receive_response
+  uint8_t           rx_ring[RX_RING_SIZE];
+  volatile uint16_t rx_head = 0;
+  volatile uint16_t rx_tail = 0;
+
+  static ModbusMaster *instances[2];
+#if MODBUS_HAL_PIO == 1
+  static ModbusMaster *pio_instances[2];
+#endif
+
+  int  build_frame(uint8_t slave_addr, const modbus_pdu_t &pdu);
+  void update_char_timing();
+  bool select_profile(int profile);
+  rtt_history_t *get_rtt_history(uint8_t slave_addr, bool create);
+  void           record_rtt(uint8_t slave_addr, uint32_t rtt_us);
+  void           on_rx_start();
+  void rx_ring_flush();
+  void schedule(uint64_t delay_us);
+  void start_tx();
+  void finish(modbus_transaction_status_t status);
+
+  void           on_rx_byte(uint8_t c);
+  void           on_tx_done();
+  void           on_uart_irq();
+  int64_t        on_alarm();
+  static void    uart_irq_handler();
+#if MODBUS_HAL_PIO == 1
+  void        on_pio_irq();
+  static void pio_irq_handler();
+#endif
+  static int64_t alarm_handler(alarm_id_t id, void *user_data);
 };
 
-#endif
\ No newline at end of file
+#endif
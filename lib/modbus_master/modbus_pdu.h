@@ -0,0 +1,81 @@
+#ifndef MODBUS_PDU_H
+#define MODBUS_PDU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Modbus PDU: function code plus payload, without the slave address and CRC that ModbusMaster adds.
+// Built with the chaining helpers or one of the factories below, kept free of SDK includes so the
+// host tools can build the same requests.
+
+#define MODBUS_MAX_PDU 253U
+#define MODBUS_MAX_WRITE_REGISTERS 123U
+#define MODBUS_MAX_WRITE_COILS 1968U
+
+struct modbus_pdu_t {
+  uint8_t data[MODBUS_MAX_PDU];
+  size_t  len      = 0;
+  bool    overflow = false;  // Set when a helper ran past MODBUS_MAX_PDU, ModbusMaster refuses such a PDU
+
+  modbus_pdu_t &u8(uint8_t value) {
+    if (len >= MODBUS_MAX_PDU) {
+      overflow = true;
+      return *this;
+    }
+    data[len++] = value;
+    return *this;
+  }
+
+  // Registers and addresses go on the wire high byte first
+  modbus_pdu_t &u16(uint16_t value) { return u8(value >> 8).u8(value & 0xFF); }
+
+  modbus_pdu_t &bytes(const uint8_t *values, size_t count) {
+    for (size_t i = 0; i < count; i++) u8(values[i]);
+    return *this;
+  }
+
+  uint8_t function() const { return len ? data[0] : 0; }
+
+  // Function code only, vendor specific requests append their payload with u8/u16/bytes
+  static modbus_pdu_t request(uint8_t function) {
+    modbus_pdu_t pdu;
+    pdu.u8(function);
+    return pdu;
+  }
+
+  // Reads (0x01-0x04) and single writes (0x05/0x06): function, address, count or value
+  static modbus_pdu_t address_value(uint8_t function, uint16_t address, uint16_t value) { return request(function).u16(address).u16(value); }
+
+  static modbus_pdu_t write_multiple_registers(uint16_t address, const uint16_t *values, uint16_t count) {
+    modbus_pdu_t pdu = request(0x10).u16(address).u16(count).u8(count * 2);
+    if (count > MODBUS_MAX_WRITE_REGISTERS)
+      pdu.overflow = true;
+    for (uint16_t i = 0; i < count && !pdu.overflow; i++) pdu.u16(values[i]);
+    return pdu;
+  }
+
+  static modbus_pdu_t write_multiple_coils(uint16_t address, const bool *values, uint16_t count) {
+    uint16_t     byte_count = (count + 7) / 8;
+    modbus_pdu_t pdu        = request(0x0F).u16(address).u16(count).u8(byte_count);
+    if (count > MODBUS_MAX_WRITE_COILS)
+      pdu.overflow = true;
+    // Coils are packed LSB first, the first coil in bit 0 of the first byte
+    for (uint16_t i = 0; i < byte_count && !pdu.overflow; i++) {
+      uint8_t packed = 0;
+      for (uint16_t bit = 0; bit < 8 && i * 8 + bit < count; bit++) packed |= values[i * 8 + bit] << bit;
+      pdu.u8(packed);
+    }
+    return pdu;
+  }
+
+  static modbus_pdu_t read_write_multiple_registers(uint16_t read_address, uint16_t read_count, uint16_t write_address, const uint16_t *values,
+                                                    uint16_t write_count) {
+    modbus_pdu_t pdu = request(0x17).u16(read_address).u16(read_count).u16(write_address).u16(write_count).u8(write_count * 2);
+    if (write_count > MODBUS_MAX_WRITE_REGISTERS - 2)
+      pdu.overflow = true;
+    for (uint16_t i = 0; i < write_count && !pdu.overflow; i++) pdu.u16(values[i]);
+    return pdu;
+  }
+};
+
+#endif
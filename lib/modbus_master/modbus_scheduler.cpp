@@ -0,0 +1,162 @@
+#include "modbus_scheduler.h"
+
+int ModbusScheduler::add_periodic(const modbus_job_t &job) {
+  if (periodic_count >= MAX_PERIODIC_JOBS)
+    return -1;
+  modbus_job_t &slot = periodic[periodic_count];
+  slot               = job;
+  slot.stats         = modbus_job_stats_t();
+  slot.release_us    = modbus_hal_time_us_64();
+  if (stats_since_us == 0)
+    stats_since_us = slot.release_us;
+  return periodic_count++;
+}
+
+bool ModbusScheduler::add_oneshot(const modbus_job_t &job) {
+  if (oneshot_count >= MAX_ONESHOT_JOBS)
+    return false;
+  modbus_job_t &slot = oneshot[oneshot_count++];
+  slot               = job;
+  slot.period_ms     = 0;
+  slot.release_us    = modbus_hal_time_us_64();
+  return true;
+}
+
+void ModbusScheduler::service() {
+  if (current) {
+    if (transaction.status == TRANSACTION_PENDING)
+      return;
+    complete_current();
+  }
+
+  if (mbm->is_busy())
+    return;
+
+  uint64_t      now = modbus_hal_time_us_64();
+  bool          is_oneshot;
+  modbus_job_t *job = pick_next(now, is_oneshot);
+  if (!job)
+    return;
+
+  bool submitted;
+  if (job->pdu)
+    submitted = mbm->submit(transaction, job->slave_addr, *job->pdu, mbm->get_response_buffer(), job->resp_len, job->timeout_ms);
+  else
+    submitted = mbm->submit(transaction, job->slave_addr, job->function, job->reg_addr, job->reg_count, mbm->get_response_buffer(), job->resp_len,
+                            job->timeout_ms);
+  if (!submitted) {
+    // A PDU or profile the master rejects would be picked again on every pass and starve everything below it
+    job->stats.runs++;
+    job->stats.errors++;
+    if (is_oneshot)
+      remove_oneshot(job);
+    else
+      advance_release(job, now);
+    return;
+  }
+
+  uint32_t jitter           = now - job->release_us;
+  job->stats.last_jitter_us = jitter;
+  if (jitter > job->stats.max_jitter_us)
+    job->stats.max_jitter_us = jitter;
+  current            = job;
+  current_is_oneshot = is_oneshot;
+}
+
+modbus_job_t *ModbusScheduler::pick_next(uint64_t now_us, bool &is_oneshot) {
+  modbus_job_t *best            = nullptr;
+  uint64_t      best_deadline   = 0;
+  bool          best_reconfig   = false;
+  int           current_profile = mbm->get_active_profile();
+
+  // Within a priority level, jobs on the serial profile already applied go first so the port is
+  // reconfigured once per batch instead of ping-ponging between slaves with different framing
+  auto consider = [&](modbus_job_t &job, bool oneshot_job) {
+    if (job.release_us > now_us)
+      return;
+    uint64_t deadline = job.release_us + (uint64_t) job.deadline_ms * 1000;
+    bool     reconfig = mbm->get_profile(job.slave_addr) != current_profile;
+    bool     better   = !best || job.priority < best->priority;
+    if (best && job.priority == best->priority)
+      better = reconfig != best_reconfig ? !reconfig : deadline < best_deadline;
+    if (better) {
+      best          = &job;
+      best_deadline = deadline;
+      best_reconfig = reconfig;
+      is_oneshot    = oneshot_job;
+    }
+  };
+
+  for (uint i = 0; i < oneshot_count; i++) consider(oneshot[i], true);
+  for (uint i = 0; i < periodic_count; i++) consider(periodic[i], false);
+  return best;
+}
+
+void ModbusScheduler::complete_current() {
+  modbus_job_t *job = current;
+  current           = nullptr;
+
+  uint32_t latency           = transaction.completed_us - job->release_us;
+  job->stats.last_latency_us = latency;
+  if (latency > job->stats.max_latency_us)
+    job->stats.max_latency_us = latency;
+  job->stats.runs++;
+  if (transaction.status != TRANSACTION_DONE)
+    job->stats.errors++;
+  if (job->deadline_ms && latency > job->deadline_ms * 1000)
+    job->stats.missed_deadlines++;
+  bus_busy_us += transaction.completed_us - transaction.submitted_us;
+
+  // The callback may queue another one-shot, so copy it out of the queue first
+  modbus_job_t finished;
+  if (current_is_oneshot) {
+    finished = *job;
+    remove_oneshot(job);
+    job = &finished;
+  } else {
+    advance_release(job, transaction.completed_us);
+  }
+
+  if (job->on_complete)
+    job->on_complete(*job, transaction);
+  transaction.status = TRANSACTION_IDLE;
+}
+
+void ModbusScheduler::remove_oneshot(modbus_job_t *job) {
+  uint index = job - oneshot;
+  for (uint i = index; i + 1 < oneshot_count; i++) oneshot[i] = oneshot[i + 1];
+  oneshot_count--;
+}
+
+void ModbusScheduler::advance_release(modbus_job_t *job, uint64_t now_us) {
+  // Periods that already elapsed while waiting for the bus are dropped rather than run back-to-back
+  uint64_t period_us = (uint64_t) job->period_ms * 1000;
+  job->release_us += period_us;
+  while (period_us && job->release_us + period_us <= now_us) {
+    job->release_us += period_us;
+    job->stats.skipped_periods++;
+  }
+}
+
+float ModbusScheduler::get_bus_utilization() {
+  uint64_t elapsed = modbus_hal_time_us_64() - stats_since_us;
+  if (elapsed == 0)
+    return 0.0f;
+  return bus_busy_us * 100.0f / elapsed;
+}
+
+void ModbusScheduler::reset_stats() {
+  for (uint i = 0; i < periodic_count; i++) periodic[i].stats = modbus_job_stats_t();
+  stats_since_us = modbus_hal_time_us_64();
+  bus_busy_us    = 0;
+}
+
+void ModbusScheduler::print_stats() {
+  printf("Modbus bus utilization: %.1f%% profile switches %u\n", get_bus_utilization(), mbm->get_profile_switches());
+  for (uint i = 0; i < periodic_count; i++) {
+    modbus_job_stats_t &s = periodic[i].stats;
+    printf("%-12s runs %u err %u missed %u skipped %u jitter %u/%uus latency %u/%uus timeout %uus\n", periodic[i].name, (uint) s.runs,
+           (uint) s.errors, (uint) s.missed_deadlines, (uint) s.skipped_periods, (uint) s.last_jitter_us, (uint) s.max_jitter_us,
+           (uint) s.last_latency_us, (uint) s.max_latency_us, (uint) mbm->get_response_timeout_us(periodic[i].slave_addr, periodic[i].timeout_ms));
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef MODBUS_SCHEDULER_H
+#define MODBUS_SCHEDULER_H
+
+#include <stdio.h>
+
+#include "modbus_master.h"
+
+#define MAX_PERIODIC_JOBS 8U
+#define MAX_ONESHOT_JOBS 4U
+
+struct modbus_job_t;
+typedef void (*modbus_job_cb_t)(modbus_job_t &job, modbus_transaction_t &transaction);
+
+struct modbus_job_stats_t {
+  uint32_t runs             = 0;
+  uint32_t errors           = 0;
+  uint32_t missed_deadlines = 0;
+  uint32_t skipped_periods  = 0;
+  uint32_t last_jitter_us   = 0;
+  uint32_t max_jitter_us    = 0;
+  uint32_t last_latency_us  = 0;
+  uint32_t max_latency_us   = 0;
+};
+
+/**
+ * @brief A request the scheduler puts on the bus, either every period_ms or once when period_ms is 0
+ * Lower priority values win, ties go to a job on the serial profile already applied, then to the earliest deadline.
+ * deadline_ms is counted from the release time and a job finishing later than that is counted as a missed deadline.
+ */
+struct modbus_job_t {
+  const char            *name        = "";
+  uint8_t                slave_addr  = 0;
+  modbus_function_code_t function    = READ_HOLDING_REGISTERS;
+  uint16_t               reg_addr    = 0;
+  uint16_t               reg_count   = 0;
+  size_t                 resp_len    = 0;
+  uint32_t               timeout_ms  = 1000;
+  uint32_t               period_ms   = 0;
+  uint8_t                priority    = 0;
+  uint32_t               deadline_ms = 0;
+  modbus_job_cb_t        on_complete = nullptr;
+  void                  *user_data   = nullptr;
+  const modbus_pdu_t    *pdu         = nullptr;  // Sent instead of function/reg_addr/reg_count when set, must outlive the job
+
+  modbus_job_stats_t stats;
+  uint64_t           release_us = 0;
+};
+
+class ModbusScheduler {
+ public:
+  ModbusScheduler(ModbusMaster &mbm) : mbm(&mbm) {}
+
+  /**
+   * @brief Register a periodic job, the first release is immediate
+   * @return Index of the job for get_job(), -1 if the table is full
+   */
+  int add_periodic(const modbus_job_t &job);
+
+  /**
+   * @brief Queue a job to run once, e.g. a parameter write or an energy reset
+   * @return false if the one-shot queue is full
+   */
+  bool add_oneshot(const modbus_job_t &job);
+
+  /**
+   * @brief Collect a finished transaction and start the next due job, call it from the main loop
+   * Job callbacks run from here, so they are free to print or touch shared state. A job the master refuses to submit counts as an error
+   * without running its callback, a one-shot is dropped and a periodic job waits for its next period.
+   */
+  void service();
+
+  modbus_job_t *get_job(int index) { return (index >= 0 && index < (int) periodic_count) ? &periodic[index] : nullptr; }
+  uint          get_job_count() { return periodic_count; }
+
+  // Percentage of wall time the bus spent inside a transaction since the last reset_stats()
+  float get_bus_utilization();
+  void  reset_stats();
+  void  print_stats();
+
+ private:
+  ModbusMaster        *mbm;
+  modbus_job_t         periodic[MAX_PERIODIC_JOBS];
+  uint                 periodic_count = 0;
+  modbus_job_t         oneshot[MAX_ONESHOT_JOBS];
+  uint                 oneshot_count      = 0;
+  modbus_job_t        *current            = nullptr;
+  bool                 current_is_oneshot = false;
+  modbus_transaction_t transaction;
+
+  uint64_t stats_since_us = 0;
+  uint64_t bus_busy_us    = 0;
+
+  modbus_job_t *pick_next(uint64_t now_us, bool &is_oneshot);
+  void          complete_current();
+  void          remove_oneshot(modbus_job_t *job);
+  void          advance_release(modbus_job_t *job, uint64_t now_us);
+};
+
+#endif
@@ -3,13 +3,12 @@
 
 #include <stdio.h>
 
-#include "modbus_master.h"
-#include "pico/stdlib.h"
+#include "modbus_slave.h"
 
 typedef enum { Source_Off, Source_AC, Source_DC } Sensed_Source;
 
 
-class ESP32 {
+class ESP32 : public ModbusSlave {
  public:
   typedef enum {
     Temperature_Value = 0x0000,
@@ -23,22 +22,22 @@ class ESP32 {
     Relay_State_High = 0x0001,
   } parameter_register_t;
 
-  typedef enum {
-    No_Error         = 0,
-    Illegal_Function = 1,
-    Illegal_Address  = 2,
-    Illegal_Data     = 3,
-    Slave_Error      = 4,
-    Timeout          = 5,
-    Invalid_Response = 6,
-    Invalid_CRC      = 7,
-  } status_t;
-
   struct Registers {
     float    temperature    = 0.0;
     uint16_t relay_state[2] = {0, 0};
   };
 
+  struct inputs_t {
+    float         temperature   = 0.0;
+    Sensed_Source sensed_source = Source_Off;
+  };
+
+  using temperature_map_t   = modbus_register_map<modbus_register<&inputs_t::temperature, Temperature_Value, uint16_t, 1, 4>>;
+  using sensed_source_map_t = modbus_register_map<modbus_register<&inputs_t::sensed_source, Supply_Status>>;
+  // Both values in one read
+  using inputs_map_t = modbus_register_map<modbus_register<&inputs_t::temperature, Temperature_Value, uint16_t, 1, 4>,
+                                           modbus_register<&inputs_t::sensed_source, Supply_Status>>;
+
  public:
   ESP32(ModbusMaster &mbm, uint8_t address);
 
@@ -46,19 +45,19 @@ class ESP32 {
 
   status_t request_temperature(float &output);
   status_t request_sensed_source(Sensed_Source &output);
+  status_t request_inputs(inputs_t &output);
 
   status_t set_relay_state(uint16_t state, uint8_t index);
+  // Both relay registers in a single write multiple registers request
+  status_t set_relay_states(uint16_t state_low, uint16_t state_high);
 
-  const char *error_to_string(status_t error);
+  // Decoders for replies collected by ModbusScheduler jobs, transaction.resp must be the shared response buffer
+  status_t finish_request_temperature(modbus_transaction_t &transaction, float &output);
+  status_t finish_request_sensed_source(modbus_transaction_t &transaction, Sensed_Source &output);
+  status_t finish_request_inputs(modbus_transaction_t &transaction, inputs_t &output);
 
  private:
-  ModbusMaster *mbm;
-  uint8_t       address;
-  uint8_t       *response_buf;
-
   Registers reg;
-
-  status_t validate_response(uint response_len, modbus_function_code_t function);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef MODBUS_REGISTER_MAP_H
+#define MODBUS_REGISTER_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+
+// Compile-time description of a slave's registers. A device lists each value once as
+// modbus_register<&Struct::member, address, raw type, scale numerator, scale denominator, word order>
+// and groups them in a modbus_register_map, which covers the smallest contiguous range holding all of
+// them so the whole struct comes back from one read. Offsets and scales are constants, the decoder
+// is a handful of loads and multiplies with no allocation.
+
+typedef enum {
+  Word_High_First,  // Modbus convention, high word at the lower address
+  Word_Low_First,   // PZEM style, low word at the lower address
+} modbus_word_order_t;
+
+template <typename T>
+struct modbus_member_traits;
+
+template <typename Struct, typename Field>
+struct modbus_member_traits<Field Struct::*> {
+  using struct_type = Struct;
+  using field_type  = Field;
+};
+
+/**
+ * @brief One 16 bit register, or a pair of them for 32 bit Raw types, decoded into a struct member
+ * The member gets raw * Num / Den. Floating point members are scaled as float, bool members are true when
+ * the raw value is non zero and integer or enum members are scaled in integer math.
+ */
+template <auto Member, uint16_t Address, typename Raw = uint16_t, int32_t Num = 1, int32_t Den = 1, modbus_word_order_t Order = Word_High_First>
+struct modbus_register {
+  using struct_type = typename modbus_member_traits<decltype(Member)>::struct_type;
+  using field_type  = typename modbus_member_traits<decltype(Member)>::field_type;
+
+  static_assert(std::is_integral<Raw>::value && (sizeof(Raw) == 2 || sizeof(Raw) == 4), "Raw must be a 16 or 32 bit integer");
+  static_assert(Den != 0, "Scale denominator can't be zero");
+
+  static constexpr uint16_t address = Address;
+  static constexpr uint16_t words   = sizeof(Raw) / 2;
+
+  static constexpr Raw raw(const uint8_t *data) {
+    uint32_t first = ((uint32_t) data[0] << 8) | data[1];
+    if constexpr (words == 1) {
+      return static_cast<Raw>(first);
+    } else {
+      uint32_t second = ((uint32_t) data[2] << 8) | data[3];
+      return static_cast<Raw>(Order == Word_High_First ? (first << 16) | second : (second << 16) | first);
+    }
+  }
+
+  // data points at the first data byte of a reply that starts at register First
+  template <uint16_t First>
+  static void decode(const uint8_t *data, struct_type &out) {
+    Raw value = raw(data + 2 * (Address - First));
+    if constexpr (std::is_same<field_type, bool>::value)
+      out.*Member = value != 0;
+    else if constexpr (std::is_floating_point<field_type>::value)
+      out.*Member = value * (static_cast<field_type>(Num) / Den);
+    else
+      out.*Member = static_cast<field_type>((int64_t) value * Num / Den);
+  }
+};
+
+/**
+ * @brief A set of registers read together into one struct
+ * first/count/response_len describe the single coalesced read that covers every register, gaps included.
+ */
+template <typename... Registers>
+struct modbus_register_map {
+  static_assert(sizeof...(Registers) > 0, "A register map needs at least one register");
+
+  using struct_type = typename std::tuple_element<0, std::tuple<typename Registers::struct_type...>>::type;
+  static_assert((std::is_same<struct_type, typename Registers::struct_type>::value && ...), "All registers must decode into the same struct");
+
+  static constexpr uint16_t first        = std::min({Registers::address...});
+  static constexpr uint16_t last         = std::max({(uint16_t) (Registers::address + Registers::words)...});
+  static constexpr uint16_t count        = last - first;
+  static constexpr size_t   response_len = 5 + 2 * count;  // Address, function, byte count, data, CRC
+
+  static_assert(count <= 125, "A single read is limited to 125 registers");
+
+  /**
+   * @brief Decode a complete read reply
+   * @return false if the reply does not have the length and byte count of this map
+   */
+  static bool decode(const uint8_t *resp, size_t len, struct_type &out) {
+    if (len != response_len || resp[2] != 2 * count)
+      return false;
+    (Registers::template decode<first>(resp + 3, out), ...);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "modbus_slave.h"
+
+const char *ModbusSlave::error_to_string(status_t error) {
+  switch (error) {
+  case No_Error:
+    return "No error";
+  case Timeout:
+    return "Timeout";
+  case Illegal_Function:
+    return "Illegal function";
+  case Illegal_Address:
+    return "Illegal address";
+  case Illegal_Data:
+    return "Illegal data";
+  case Slave_Error:
+    return "Slave error";
+  case Invalid_Response:
+    return "Invalid response";
+  case Invalid_CRC:
+    return "Invalid CRC";
+  default:
+    return "Unknown error";
+  }
+}
+
+ModbusSlave::status_t ModbusSlave::exception_to_status(uint8_t exception_code) {
+  // Codes above 4 (acknowledge, busy, gateway...) would alias Timeout and the local errors, they are all a slave side failure to us
+  switch (exception_code) {
+  case Illegal_Function:
+  case Illegal_Address:
+  case Illegal_Data:
+    return (status_t) exception_code;
+  default:
+    return Slave_Error;
+  }
+}
+
+ModbusSlave::status_t ModbusSlave::validate_response(modbus_function_code_t function) {
+  // The CRC was already checked by ModbusMaster while the frame was received
+  if (response_buf[0] != address)
+    return Invalid_Response;
+  if (response_buf[1] == (function | 0x80))
+    return exception_to_status(response_buf[2]);
+  if (response_buf[1] != function)
+    return Invalid_Response;
+  return No_Error;
+}
+
+ModbusSlave::status_t ModbusSlave::validate_transaction(modbus_transaction_t &transaction, uint response_len, modbus_function_code_t function) {
+  modbus_transaction_status_t transaction_status = transaction.status;
+  transaction.status                             = TRANSACTION_IDLE;
+  if (transaction_status == TRANSACTION_TIMEOUT)
+    return Timeout;
+  if (transaction_status == TRANSACTION_INVALID_CRC)
+    return Invalid_CRC;
+  if (transaction_status == TRANSACTION_EXCEPTION)
+    return exception_to_status(transaction.exception_code);
+  if (transaction.received != response_len)
+    return Invalid_Response;
+  return validate_response(function);
+}
+
+ModbusSlave::status_t ModbusSlave::write_register(uint16_t reg_addr, uint16_t value, uint pre_tx_delay, uint post_tx_delay) {
+  mbm->send_message(address, WRITE_SINGLE_REGISTER, reg_addr, value, pre_tx_delay, post_tx_delay);
+  if (!mbm->receive_response(response_buf, 8, 1000))
+    return Timeout;
+  return validate_response(WRITE_SINGLE_REGISTER);
+}
+
+ModbusSlave::status_t ModbusSlave::write_registers(uint16_t reg_addr, const uint16_t *values, uint16_t count, uint pre_tx_delay,
+                                                   uint post_tx_delay) {
+  if (!mbm->send_pdu(address, modbus_pdu_t::write_multiple_registers(reg_addr, values, count), pre_tx_delay, post_tx_delay))
+    return Invalid_Response;
+  // The reply echoes the start address and count
+  if (!mbm->receive_response(response_buf, 8, 1000))
+    return Timeout;
+  return validate_response(WRITE_MULTIPLE_REGISTERS);
+}
@@ -0,0 +1,75 @@
+#ifndef MODBUS_SLAVE_H
+#define MODBUS_SLAVE_H
+
+#include <stdio.h>
+
+#include "modbus_master.h"
+#include "modbus_register_map.h"
+
+/**
+ * @brief Common part of the rs485 slave drivers: status codes, reply validation and register map reads
+ * Replies land in the ModbusMaster response buffer, drivers decode them through a modbus_register_map.
+ */
+class ModbusSlave {
+ public:
+  typedef enum {
+    No_Error         = 0,
+    Illegal_Function = 1,
+    Illegal_Address  = 2,
+    Illegal_Data     = 3,
+    Slave_Error      = 4,
+    Timeout          = 5,
+    Invalid_Response = 6,
+    Invalid_CRC      = 7,
+  } status_t;
+
+  ModbusSlave(ModbusMaster &mbm, uint8_t address) : mbm(&mbm), address(address), response_buf(mbm.get_response_buffer()) {}
+
+  uint8_t get_address() { return address; }
+
+  static const char *error_to_string(status_t error);
+
+ protected:
+  ModbusMaster *mbm;
+  uint8_t       address;
+  uint8_t      *response_buf;
+
+  static status_t exception_to_status(uint8_t exception_code);
+  // Checks the address and function of the reply in response_buf, its length and CRC were checked on reception
+  status_t validate_response(modbus_function_code_t function);
+  status_t validate_transaction(modbus_transaction_t &transaction, uint response_len, modbus_function_code_t function);
+
+  // Blocking write of one register, the reply is the 8 byte echo of the request
+  status_t write_register(uint16_t reg_addr, uint16_t value, uint pre_tx_delay = 5, uint post_tx_delay = 5);
+
+  // Blocking write of count consecutive registers in one 0x10 request
+  status_t write_registers(uint16_t reg_addr, const uint16_t *values, uint16_t count, uint pre_tx_delay = 5, uint post_tx_delay = 5);
+
+  // Blocking read of everything in Map
+  template <typename Map>
+  status_t read_map(typename Map::struct_type &output, modbus_function_code_t function, uint pre_tx_delay = 5, uint post_tx_delay = 5,
+                    uint32_t timeout_ms = 1000) {
+    mbm->send_message(address, function, Map::first, Map::count, pre_tx_delay, post_tx_delay);
+    if (!mbm->receive_response(response_buf, Map::response_len, timeout_ms))
+      return Timeout;
+    status_t status = validate_response(function);
+    if (status != No_Error)
+      return status;
+    return Map::decode(response_buf, Map::response_len, output) ? No_Error : Invalid_Response;
+  }
+
+  template <typename Map>
+  bool begin_map(modbus_transaction_t &transaction, modbus_function_code_t function, uint32_t timeout_ms = 1000) {
+    return mbm->submit(transaction, address, function, Map::first, Map::count, response_buf, Map::response_len, timeout_ms);
+  }
+
+  template <typename Map>
+  status_t finish_map(modbus_transaction_t &transaction, typename Map::struct_type &output, modbus_function_code_t function) {
+    status_t status = validate_transaction(transaction, Map::response_len, function);
+    if (status != No_Error)
+      return status;
+    return Map::decode(response_buf, Map::response_len, output) ? No_Error : Invalid_Response;
+  }
+};
+
+#endif
@@ -1,11 +1,10 @@
 #ifndef PZEM016_H
 #define PZEM016_H
 
-#include "pico/stdlib.h"
 #include <stdio.h>
-#include "modbus_master.h"
+#include "modbus_slave.h"
 
-class PZEM016 {
+class PZEM016 : public ModbusSlave {
 public:
   typedef enum {
     Voltage_Value = 0x0000,
@@ -30,17 +29,6 @@ public:
     Modbus_RTU_Address_Parameter = 0x0002,
   } parameter_register_t;
 
-  typedef enum {
-    No_Error = 0,
-    Illegal_Function = 1,
-    Illegal_Address = 2,
-    Illegal_Data = 3,
-    Slave_Error = 4,
-    Timeout = 5,
-    Invalid_Response = 6,
-    Invalid_CRC = 7,
-  } status_t;
-
   struct measurement_t {
     float voltage;
     float current;
@@ -51,6 +39,16 @@ public:
     bool alarm_status;
   };
 
+  // Whole measurement block in one read, 32 bit values have the low word first
+  using measurement_map_t = modbus_register_map<
+      modbus_register<&measurement_t::voltage, Voltage_Value, uint16_t, 1, 10>,
+      modbus_register<&measurement_t::current, Current_Value, uint32_t, 1, 1000, Word_Low_First>,
+      modbus_register<&measurement_t::power, Power_Value_Low, uint32_t, 1, 10, Word_Low_First>,
+      modbus_register<&measurement_t::energy, Energy_Value_Low, uint32_t, 1, 1000, Word_Low_First>,  // Wh to kWh
+      modbus_register<&measurement_t::frequency, Frequency_Value, uint16_t, 1, 10>,
+      modbus_register<&measurement_t::power_factor, Power_Factor_Value, uint16_t, 1, 100>,
+      modbus_register<&measurement_t::alarm_status, Alarm_Status>>;
+
 public:
   PZEM016(ModbusMaster &mbm, uint8_t address);
 
@@ -64,16 +62,6 @@ public:
   status_t set_modbus_rtu_address(uint16_t value);
 
   status_t reset_energy();
-
-  const char *error_to_string(status_t error);
-
-private:
-  ModbusMaster *mbm;
-  uint8_t address;
-  uint8_t *response_buf;
-
-  status_t validate_response(uint response_len,
-                             modbus_function_code_t function, uint8_t addr);
 };
 
 #endif
\ No newline at end of file
@@ -1,11 +1,10 @@
 #ifndef PZEM017_H
 #define PZEM017_H
 
-#include "pico/stdlib.h"
 #include <stdio.h>
-#include "modbus_master.h"
+#include "modbus_slave.h"
 
-class PZEM017 {
+class PZEM017 : public ModbusSlave {
 public:
   typedef enum {
     Voltage_Value = 0x00,
@@ -34,17 +33,6 @@ public:
     Current_Range_Parameter = 0x03,
   } parameter_register_t;
 
-  typedef enum {
-    No_Error = 0,
-    Illegal_Function = 1,
-    Illegal_Address = 2,
-    Illegal_Data = 3,
-    Slave_Error = 4,
-    Timeout = 5,
-    Invalid_Response = 6,
-    Invalid_CRC = 7,
-  } status_t;
-
   struct measurement_t {
     float voltage;
     float current;
@@ -54,11 +42,30 @@ public:
     bool low_voltage_alarm;
   };
 
+  // Whole measurement block in one read, 32 bit values have the low word first
+  using measurement_map_t = modbus_register_map<
+      modbus_register<&measurement_t::voltage, Voltage_Value, uint16_t, 1, 100>,
+      modbus_register<&measurement_t::current, Current_Value, uint16_t, 1, 100>,
+      modbus_register<&measurement_t::power, Power_Value_Low, uint32_t, 1, 10, Word_Low_First>,
+      modbus_register<&measurement_t::energy, Energy_Value_Low, uint32_t, 1, 1, Word_Low_First>,
+      modbus_register<&measurement_t::high_voltage_alarm, High_Voltage_Alarm>,
+      modbus_register<&measurement_t::low_voltage_alarm, Low_Voltage_Alarm>>;
+
 public:
   PZEM017(ModbusMaster &mbm, uint8_t address);
 
   status_t request_all(measurement_t &output);
 
+  /**
+   * @brief Start a non-blocking read of all measurement registers
+   * @param transaction Polled by the caller, pass it to finish_request_all once it leaves TRANSACTION_PENDING
+   * @return false if the bus is busy with another transaction
+   */
+  bool begin_request_all(modbus_transaction_t &transaction);
+
+  status_t finish_request_all(modbus_transaction_t &transaction, measurement_t &output);
+  status_t finish_reset_energy(modbus_transaction_t &transaction);
+
   /**
    * @brief Set the high voltage alarm parameter
    * @param value The high voltage alarm parameter, default is 300V, range is 5
@@ -92,17 +99,10 @@ public:
 
   status_t reset_energy();
 
-  status_t calibrate();
-
-  const char *error_to_string(status_t error);
+  // Function code only, for queueing the reset as a scheduler job
+  static modbus_pdu_t reset_energy_request() { return modbus_pdu_t::request(Reset_Energy); }
 
-private:
-  ModbusMaster *mbm;
-  uint8_t address;
-  uint8_t *response_buf;
-
-  status_t validate_response(uint response_len,
-                             modbus_function_code_t function, uint8_t addr);
+  status_t calibrate();
 };
 
 #endif
\ No newline at end of file
@@ -1,10 +1,21 @@
 #include "xpt2046.h"
+#include "dma_manager.h"
 #include "hardware/gpio.h"
 
+// Conversion commands, differential mode and powered down in between so
+// PENIRQ stays enabled. Bursts convert each in turn XPT2046_SAMPLES times.
+static const uint8_t burst_commands[4] = {0x90, 0xD0, 0xB0, 0xC0};
+static_assert(XPT2046_SAMPLES >= 3, "the filter averages three samples");
+
+XPT2046 *XPT2046::sampling = nullptr;
+
 XPT2046::XPT2046(spi_inst_t *spi, uint mosi, uint miso, uint sck, uint cs,
                  uint irq)
-    : spi(spi), mosi_pin(mosi), miso_pin(miso), sck_pin(sck), cs_pin(cs_pin),
-      irq_pin(irq) {}
+    : spi(spi), cs_pin(cs), mosi_pin(mosi), miso_pin(miso), sck_pin(sck),
+      irq_pin(irq) {
+  set_rotation(LANDSCAPE);
+  set_calibration(220, 3900, 180, 3850);
+}
 
 void XPT2046::begin(Rotations rotation) {
   set_rotation(rotation);
@@ -39,25 +50,8 @@ bool XPT2046::is_touched() {
 
 bool XPT2046::get_touch(uint16_t &x, uint16_t &y) {
   uint16_t raw_x, raw_y;
-  get_mapped_raw(raw_x, raw_y);
-  switch (rotation) {
-  case PORTRAIT:
-    x = raw_y;
-    y = raw_x;
-    break;
-  case INVERTED_PORTRAIT:
-    x = width - raw_x;
-    y = height - raw_y;
-    break;
-  case LANDSCAPE:
-    x = width - raw_x;
-    y = height - raw_y;
-    break;
-  case INVERTED_LANDSCAPE:
-    x = raw_x;
-    y = raw_y;
-    break;
-  }
+  get_raw(raw_x, raw_y);
+  map(raw_x, raw_y, x, y);
   return true;
 }
 
@@ -93,39 +87,109 @@ uint16_t XPT2046::spi_read() {
   return data;
 }
 
+// The plain mapping scaled the bounds to the screen and flipped both axes in
+// LANDSCAPE, where screen x is the panel row and y the column
 void XPT2046::set_calibration(uint16_t xmin, uint16_t xmax, uint16_t ymin,
-                             uint16_t ymax) {
-  x_min = xmin;
-  x_max = xmax;
-  y_min = ymin;
-  y_max = ymax;
+                              uint16_t ymax) {
+  Calibration cal = {};
+  cal.b = -((int64_t)panel_width << 16) / (ymax - ymin);
+  cal.c0 = ((int64_t)panel_width * ymax << 16) / (ymax - ymin);
+  cal.d = -((int64_t)panel_height << 16) / (xmax - xmin);
+  cal.f = ((int64_t)panel_height * xmax << 16) / (xmax - xmin);
+  set_calibration(cal);
+}
+
+void XPT2046::set_calibration(const Calibration &cal) {
+  calibration = cal;
+  update_screen_map();
+}
+
+// Solves p = k0 * raw_x + k1 * raw_y + k2 for one coordinate of the three
+// points, false when the Q16 result could overflow map()
+static bool solve_affine(const int64_t rx[3], const int64_t ry[3],
+                         const int64_t p[3], int64_t det, int32_t k[3]) {
+  int64_t k0 = (((p[0] - p[2]) * (ry[1] - ry[2]) -
+                 (p[1] - p[2]) * (ry[0] - ry[2])) << 16) / det;
+  int64_t k1 = (((rx[0] - rx[2]) * (p[1] - p[2]) -
+                 (rx[1] - rx[2]) * (p[0] - p[2])) << 16) / det;
+  // Up to a pixel per count keeps the sums of map() within 31 bits
+  if (k0 <= -(1 << 16) || k0 >= (1 << 16) || k1 <= -(1 << 16) ||
+      k1 >= (1 << 16))
+    return false;
+  k[0] = k0;
+  k[1] = k1;
+  k[2] = (p[0] << 16) - k0 * rx[0] - k1 * ry[0];
+  return true;
+}
+
+bool XPT2046::calibrate(const uint16_t raw[3][2], const uint16_t screen[3][2]) {
+  int64_t rx[3], ry[3], c[3], r[3];
+  for (int i = 0; i < 3; i++) {
+    rx[i] = raw[i][0];
+    ry[i] = raw[i][1];
+    // Screen points back to the panel frame, the inverse of update_screen_map()
+    uint16_t x = screen[i][0], y = screen[i][1];
+    switch (rotation) {
+    case PORTRAIT:
+      c[i] = panel_width - 1 - x;
+      r[i] = y;
+      break;
+    case LANDSCAPE:
+      c[i] = y;
+      r[i] = x;
+      break;
+    case INVERTED_PORTRAIT:
+      c[i] = x;
+      r[i] = panel_height - 1 - y;
+      break;
+    case INVERTED_LANDSCAPE:
+      c[i] = panel_width - 1 - y;
+      r[i] = panel_height - 1 - x;
+      break;
+    }
+  }
+  int64_t det = (rx[0] - rx[2]) * (ry[1] - ry[2]) -
+                (rx[1] - rx[2]) * (ry[0] - ry[2]);
+  if (det == 0)
+    return false;
+  int32_t kc[3], kr[3];
+  if (!solve_affine(rx, ry, c, det, kc) || !solve_affine(rx, ry, r, det, kr))
+    return false;
+  set_calibration({kc[0], kc[1], kc[2], kr[0], kr[1], kr[2]});
+  return true;
+}
+
+// Folds the rotation into the calibration so map() is two multiply-adds per
+// axis. Matches the MADCTL settings of ILI9486Drivers::set_rotation().
+void XPT2046::update_screen_map() {
+  const Calibration &k = calibration;
+  const int32_t last_c = (panel_width - 1) << 16;
+  const int32_t last_r = (panel_height - 1) << 16;
+  switch (rotation) {
+  case PORTRAIT: // x = last column - c, y = r
+    screen_map = {-k.a, -k.b, last_c - k.c0, k.d, k.e, k.f};
+    break;
+  case LANDSCAPE: // x = r, y = c
+    screen_map = {k.d, k.e, k.f, k.a, k.b, k.c0};
+    break;
+  case INVERTED_PORTRAIT: // x = c, y = last row - r
+    screen_map = {k.a, k.b, k.c0, -k.d, -k.e, last_r - k.f};
+    break;
+  case INVERTED_LANDSCAPE: // x = last row - r, y = last column - c
+    screen_map = {-k.d, -k.e, last_r - k.f, -k.a, -k.b, last_c - k.c0};
+    break;
+  }
 }
 
 void XPT2046::map(uint16_t x, uint16_t y, uint16_t &x_mapped,
                   uint16_t &y_mapped) {
-  // Handle underflow (x < x_min or y < y_min)
-  if (x < x_min)
-    x = x_min;
-  if (y < y_min)
-    y = y_min;
-
-  // Handle overflow (x > x_max or y > y_max)
-  if (x > x_max)
-    x = x_max;
-  if (y > y_max)
-    y = y_max;
-
-  // Map the coordinates to display dimensions
-  x_mapped = static_cast<uint16_t>(static_cast<uint32_t>(x - x_min) *
-                                   width / (x_max - x_min));
-  y_mapped = static_cast<uint16_t>(static_cast<uint32_t>(y - y_min) *
-                                   height / (y_max - y_min));
+  const Calibration &m = screen_map;
+  int32_t sx = (m.a * x + m.b * y + m.c0 + 0x8000) >> 16;
+  int32_t sy = (m.d * x + m.e * y + m.f + 0x8000) >> 16;
 
   // Clamp the mapped values to ensure they stay within display bounds
-  if (x_mapped >= width)
-    x_mapped = width - 1;
-  if (y_mapped >= height)
-    y_mapped = height - 1;
+  x_mapped = sx < 0 ? 0 : sx >= width ? width - 1 : sx;
+  y_mapped = sy < 0 ? 0 : sy >= height ? height - 1 : sy;
 }
 
 void XPT2046::get_raw(uint16_t &x, uint16_t &y) {
@@ -133,12 +197,6 @@ void XPT2046::get_raw(uint16_t &x, uint16_t &y) {
   y = read_data(0xD0);
 }
 
-void XPT2046::get_mapped_raw(uint16_t &x, uint16_t &y) {
-  uint16_t raw_x, raw_y;
-  get_raw(raw_x, raw_y);
-  map(raw_x, raw_y, x, y);
-}
-
 void XPT2046::set_rotation(Rotations rotation) {
   this->rotation = rotation;
   bool swap_dims = false;
@@ -156,4 +214,150 @@ void XPT2046::set_rotation(Rotations rotation) {
   }
   width = swap_dims ? panel_height : panel_width;
   height = swap_dims ? panel_width : panel_height;
-}
\ No newline at end of file
+  update_screen_map();
+}
+
+bool XPT2046::start_sampling(uint32_t period_us) {
+  if (!irq_pin || sampling)
+    return false;
+  dma_rx = dma_manager_claim(false, burst_complete, this);
+  dma_tx = dma_manager_claim(false);
+  if (dma_rx < 0 || dma_tx < 0) {
+    if (dma_rx >= 0)
+      dma_manager_unclaim(dma_rx);
+    if (dma_tx >= 0)
+      dma_manager_unclaim(dma_tx);
+    dma_rx = dma_tx = -1;
+    return false;
+  }
+  // The default pool fires on core0, a pool of our own takes its alarm IRQ on
+  // this core like the PENIRQ and DMA ones, so the restarts never race
+  int alarm = hardware_alarm_claim_unused(false);
+  if (alarm >= 0) {
+    // alarm_pool_create() claims it again and panics when it can't
+    hardware_alarm_unclaim(alarm);
+    alarm_pool = alarm_pool_create(alarm, 1);
+  }
+  if (!alarm_pool) {
+    dma_manager_unclaim(dma_rx);
+    dma_manager_unclaim(dma_tx);
+    dma_rx = dma_tx = -1;
+    return false;
+  }
+  sample_period_us = period_us;
+  sampling = this;
+
+  // A command byte and two clocking bytes per conversion, CS stays low for
+  // the whole burst
+  for (uint i = 0; i < burst_len; i += 3) {
+    burst_tx[i] = burst_commands[i / 3 / XPT2046_SAMPLES];
+    burst_tx[i + 1] = 0;
+    burst_tx[i + 2] = 0;
+  }
+  dma_channel_config c = dma_channel_get_default_config(dma_tx);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+  channel_config_set_dreq(&c, spi_get_dreq(spi, true));
+  dma_channel_configure(dma_tx, &c, &spi_get_hw(spi)->dr, burst_tx, burst_len,
+                        false);
+  c = dma_channel_get_default_config(dma_rx);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+  channel_config_set_dreq(&c, spi_get_dreq(spi, false));
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, true);
+  dma_channel_configure(dma_rx, &c, burst_rx, &spi_get_hw(spi)->dr, burst_len,
+                        false);
+
+  gpio_add_raw_irq_handler(irq_pin, penirq_handler);
+  irq_set_enabled(IO_IRQ_BANK0, true);
+  arm_penirq();
+  return true;
+}
+
+bool XPT2046::get_sampled(uint16_t &x, uint16_t &y) {
+  uint32_t s = sampled;
+  if (!(s & (1u << 31)))
+    return false;
+  map(s & 0xFFF, (s >> 12) & 0xFFF, x, y);
+  return true;
+}
+
+bool XPT2046::get_sampled_raw(uint16_t &x, uint16_t &y) {
+  uint32_t s = sampled;
+  x = s & 0xFFF;
+  y = (s >> 12) & 0xFFF;
+  return s & (1u << 31);
+}
+
+// Either the pen is up and PENIRQ armed, or a burst or the alarm for the next
+// one is pending, never two of them
+void XPT2046::arm_penirq() {
+  gpio_acknowledge_irq(irq_pin, GPIO_IRQ_EDGE_FALL);
+  gpio_set_irq_enabled(irq_pin, GPIO_IRQ_EDGE_FALL, true);
+  // Still pressed, or pressed again before the edge was armed. A light
+  // touch keeps PENIRQ low, so this waits a period rather than spin on bursts
+  if (!gpio_get(irq_pin)) {
+    gpio_set_irq_enabled(irq_pin, GPIO_IRQ_EDGE_FALL, false);
+    schedule_burst();
+  }
+}
+
+void XPT2046::schedule_burst() {
+  // Out of alarms, the next burst goes without a pause
+  if (alarm_pool_add_alarm_in_us(alarm_pool, sample_period_us, burst_alarm,
+                                 this, true) < 0)
+    start_burst();
+}
+
+void XPT2046::start_burst() {
+  gpio_put(cs_pin, 0);
+  dma_channel_set_write_addr(dma_rx, burst_rx, false);
+  dma_channel_set_trans_count(dma_rx, burst_len, true);
+  dma_channel_set_read_addr(dma_tx, burst_tx, false);
+  dma_channel_set_trans_count(dma_tx, burst_len, true);
+}
+
+void __isr XPT2046::penirq_handler() {
+  XPT2046 *t = sampling;
+  if (!t || !(gpio_get_irq_event_mask(t->irq_pin) & GPIO_IRQ_EDGE_FALL))
+    return;
+  // PENIRQ also moves during conversions, it is off until the pen is up
+  gpio_set_irq_enabled(t->irq_pin, GPIO_IRQ_EDGE_FALL, false);
+  gpio_acknowledge_irq(t->irq_pin, GPIO_IRQ_EDGE_FALL);
+  t->start_burst();
+}
+
+int64_t XPT2046::burst_alarm(alarm_id_t, void *user_data) {
+  static_cast<XPT2046 *>(user_data)->start_burst();
+  return 0;
+}
+
+// Median of the axis' conversions averaged with its two neighbours
+uint16_t XPT2046::filter(uint axis) {
+  uint16_t v[XPT2046_SAMPLES];
+  for (uint i = 0; i < XPT2046_SAMPLES; i++) {
+    const uint8_t *rx = &burst_rx[(axis * XPT2046_SAMPLES + i) * 3];
+    uint16_t value = (rx[1] << 5) | (rx[2] >> 3);
+    uint j = i;
+    for (; j > 0 && v[j - 1] > value; j--)
+      v[j] = v[j - 1];
+    v[j] = value;
+  }
+  const uint mid = XPT2046_SAMPLES / 2;
+  return (v[mid - 1] + v[mid] + v[mid + 1]) / 3;
+}
+
+void XPT2046::burst_complete(uint channel, void *user_data) {
+  XPT2046 *t = static_cast<XPT2046 *>(user_data);
+  gpio_put(t->cs_pin, 1);
+  uint16_t x = t->filter(0);
+  uint16_t y = t->filter(1);
+  uint16_t z = t->filter(2) + 4095 - t->filter(3);
+  t->pressure = z;
+  if (z >= t->z_threshold) {
+    t->sampled = (1u << 31) | ((uint32_t)y << 12) | x;
+    t->schedule_burst();
+  } else {
+    t->sampled = t->sampled & ~(1u << 31);
+    t->arm_penirq();
+  }
+}
@@ -5,16 +5,36 @@
 #include "ili9486_drivers.h"
 #include "pico/stdlib.h"
 
+// Conversions per axis in a background burst, median of them averaged
+#define XPT2046_SAMPLES 5
+// Pressure (z1 + 4095 - z2) below this reads as released
+#define XPT2046_Z_THRESHOLD 350
+
 class XPT2046 {
 public:
+  // Affine map from raw readings to the panel's own portrait frame (column c
+  // of panel_width, row r of panel_height) in Q16:
+  //   c = (a * raw_x + b * raw_y + c0) >> 16, r = (d * raw_x + e * raw_y + f) >> 16
+  struct Calibration {
+    int32_t a, b, c0;
+    int32_t d, e, f;
+  };
+
   XPT2046(spi_inst_t *spi, uint mosi, uint miso, uint sck, uint cs,
           uint irq = 0);
 
   void begin(Rotations rotation);
   bool is_touched();
   bool get_touch(uint16_t &x, uint16_t &y);
+  // Bounds of the plain linear mapping, as read in LANDSCAPE
   void set_calibration(uint16_t xmin, uint16_t xmax, uint16_t ymin,
                       uint16_t ymax);
+  void set_calibration(const Calibration &cal);
+  const Calibration &get_calibration() { return calibration; }
+  // Solves the map from raw readings of three screen points, given in the
+  // current rotation. False, keeping the old map, when the points are too
+  // close to a line or the map comes out of range.
+  bool calibrate(const uint16_t raw[3][2], const uint16_t screen[3][2]);
   void get_raw(uint16_t &x, uint16_t &y);
   void set_rotation(Rotations rotation);
 
@@ -22,8 +42,21 @@ public:
   void enable_interrupt();
   void disable_interrupt();
   bool get_interrupt() { return gpio_get(irq_pin); }
+  // Raw reading to display coordinates of the current rotation
   void map(uint16_t x, uint16_t y, uint16_t &x_mapped, uint16_t &y_mapped);
-  void get_mapped_raw(uint16_t &x, uint16_t &y);
+
+  // Background sampling: a PENIRQ edge starts a DMA burst of X/Y/Z1/Z2
+  // conversions, repeated every period_us while the panel is pressed. The
+  // filtered point is published for get_sampled(). Needs the IRQ pin, false
+  // when there is none or no DMA channel or hardware alarm is left. Call on
+  // the core that reads, the PENIRQ, DMA and period alarm interrupts are all
+  // taken there, so a burst is never restarted from the other core.
+  bool start_sampling(uint32_t period_us = 5000);
+  // Latest filtered point in display coordinates, constant time
+  bool get_sampled(uint16_t &x, uint16_t &y);
+  bool get_sampled_raw(uint16_t &x, uint16_t &y);
+  uint16_t get_pressure() { return pressure; }
+  void set_pressure_threshold(uint16_t z) { z_threshold = z; }
 
 private:
   spi_inst_t *spi;
@@ -34,15 +67,37 @@ private:
   uint16_t width;
   uint16_t height;
 
-  // Calibration values
-  uint16_t x_min = 220, x_max = 3900;
-  uint16_t y_min = 180, y_max = 3850;
+  Calibration calibration;
+  // calibration composed with the rotation, what map() runs
+  Calibration screen_map;
+
+  // Background sampling
+  static constexpr uint burst_len = XPT2046_SAMPLES * 4 * 3;
+  int dma_tx = -1, dma_rx = -1;
+  uint32_t sample_period_us = 0;
+  alarm_pool_t *alarm_pool = nullptr;
+  uint16_t z_threshold = XPT2046_Z_THRESHOLD;
+  volatile uint16_t pressure = 0;
+  // x in bits 0-11, y in 12-23, bit 31 pressed, one store so readers never
+  // see half a point
+  volatile uint32_t sampled = 0;
+  uint8_t burst_tx[burst_len];
+  uint8_t burst_rx[burst_len];
 
   uint16_t read_data(uint8_t command);
   void spi_write(uint8_t data);
   uint16_t spi_read();
   void start_transaction();
   void end_transaction();
+  void update_screen_map();
+  uint16_t filter(uint axis);
+  void start_burst();
+  void schedule_burst();
+  void arm_penirq();
+  static void penirq_handler();
+  static void burst_complete(uint channel, void *user_data);
+  static int64_t burst_alarm(alarm_id_t id, void *user_data);
+  static XPT2046 *sampling;
 };
 
 #endif
\ No newline at end of file
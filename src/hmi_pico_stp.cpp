@@ -19,6 +19,7 @@
 #include "lv_drivers.h"
 #include "math.h"
 #include "modbus_master.h"
+#include "modbus_scheduler.h"
 #include "pico/cyw43_arch.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
@@ -26,6 +27,9 @@
 #include "pico/time.h"
 #include "plc_utility.hpp"
 #include "pzem017.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+#include "trend_buffer.h"
 #include "xpt2046.h"
 
 // lwIP includes for HTTP client
@@ -41,8 +45,6 @@ struct MachineState {
   bool          polarity_flipped = false;
 };
 
-static repeating_timer one_sec_timer;
-
 constexpr int processor_mhz = 250;
 
 bool reset_pzem;
@@ -73,16 +75,64 @@ uint32_t      modbus_baudrate  = 9600;
 uint32_t      modbus_data_bits = 8;
 uint32_t      modbus_stop_bits = 2;
 uart_parity_t modbus_parity    = UART_PARITY_NONE;
+// 1 runs the port on PIO with DE timed by the state machine, 0 uses the hardware UART with software DE
+#define MODBUS_PIO_BACKEND 1
 ModbusMaster  mbm = ModbusMaster(modbus_de_re, modbus_rx, modbus_tx, modbus_uart, modbus_baudrate, modbus_data_bits, modbus_stop_bits, modbus_parity);
 
-PZEM017                pzem017 = PZEM017(mbm, 0xF8);
+constexpr uint8_t      pzem017_address = 0xF8;
+constexpr uint8_t      esp32_address   = 0x01;
+PZEM017                pzem017         = PZEM017(mbm, pzem017_address);
 PZEM017::measurement_t pzem017_measurement;
+ESP32                  esp32            = ESP32(mbm, esp32_address);
+ModbusScheduler        modbus_scheduler = ModbusScheduler(mbm);
+
+const modbus_pdu_t pzem017_reset_pdu = PZEM017::reset_energy_request();
+
+// 1 keeps the last ~8KB of bus traffic in RAM, sending 'C' over USB dumps it for tools/modbus_capture.cpp, 'X' clears it. Off by
+// default, the dump shares USB stdio with core1's printf output, which would corrupt the binary stream
+#define MODBUS_CAPTURE 0
+#if MODBUS_CAPTURE == 1
+ModbusCapture modbus_capture;
+void          modbus_capture_put(uint8_t c) { putchar_raw(c); }
+#endif
+
+// 1 prints the display flush pipeline timings, frame pacing counters and input latency every 10 s, see
+// lvgl_display_print_flush_stats()
+#define DISPLAY_FLUSH_STATS 0
+// LVGL_PROFILER (lv_drivers.h) 1 adds the diagnostics screen on a long press of the top bar, 'P' over USB dumps the histograms,
+// 'Z' clears them
+
+// Following values are shared between the two cores, each with a single writer: the measurements are published by core0, the
+// settings and the status by the core1 loop
+Seqlock<Big_Labels_Value>     shared_big_labels_value;
+Seqlock<Setting_Labels_Value> shared_setting_labels_value;
+Seqlock<Status_Labels_Value>  shared_status_labels_value;
+// Temperature from the ESP32, stored by core0 in one go and put into the status by core1
+volatile float esp32_temperature = 0;
+
+// PZEM017 samples for the trend view, written by core0, read by core1
+TrendBuffer<trend_sample_t, 256> pzem017_trend;
+
+// Encoder and front panel input, pushed by encoder_service() and input_service() and applied by the core1 loop in input_apply(). Both
+// timers run from the default alarm pool's IRQ so they never interleave and count as one producer.
+enum Input_Event_Type : uint8_t { Input_Encoder, Input_Click, Input_Held, Input_Start, Input_Stop, Input_Source };
+struct input_event_t {
+  uint32_t         time_us;
+  Input_Event_Type type;
+  int16_t          value;  // Encoder steps or Sensed_Source
+};
+SpscQueue<input_event_t, 64> input_queue;
 
-// Following variabbles are shared between the two cores
-Big_Labels_Value     shared_big_labels_value;
-Setting_Labels_Value shared_setting_labels_value;
-Status_Labels_Value  shared_status_labels_value;
-mutex_t              shared_data_mutex;
+// Time from the oldest event of a batch to the end of the first frame drawn after applying it
+struct input_latency_t {
+  uint32_t batches;
+  uint32_t sum_us;
+  uint32_t max_us;
+};
+static input_latency_t input_latency     = {};
+static bool            input_pending     = false;  // Events applied that no frame has shown yet
+static uint32_t        input_pending_us  = 0;
+static uint32_t        input_last_frames = 0;
 
 std::vector<std::string> wifi_list;
 std::string              connected_wifi;
@@ -115,13 +165,23 @@ Status_Labels_Value  status_labels_value;
 
 MachineState machine_state;
 
+static bool trend_view_request = false;
+
 void        wifi_cb_dummy(EventData *ed);
 void        core1_entry();
 void        core0_entry();
 void        changes_cb(EventData *data);
 bool        encoder_service(struct repeating_timer *t);
 bool        input_service(struct repeating_timer *t);
-bool        one_sec_service(struct repeating_timer *t);
+void        one_sec_service();
+void        pzem017_sample_cb(modbus_job_t &job, modbus_transaction_t &transaction);
+void        pzem017_reset_cb(modbus_job_t &job, modbus_transaction_t &transaction);
+void        esp32_inputs_cb(modbus_job_t &job, modbus_transaction_t &transaction);
+void        trend_view_service();
+void        input_apply();
+void        input_latency_update();
+void        input_print_latency();
+void        input_reset_latency();
 const char *wifi_error_to_string_id(int error_code);
 
 // WiFi helper functions
@@ -177,8 +237,6 @@ int main() {
 
   clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS, processor_mhz * 1000 * 1000, processor_mhz * 1000 * 1000);
 
-  mutex_init(&shared_data_mutex);
-
   if (cyw43_arch_init()) {
     printf("failed to initialise\n");
     return 1;
@@ -192,7 +250,21 @@ int main() {
 }
 
 void core0_entry() {
+  // Lets core1 pause this core while it writes the touch calibration to flash
+  multicore_lockout_victim_init();
+#if MODBUS_PIO_BACKEND == 1
+  // The CYW43 driver already holds a PIO, init_pio falls back to the UART if pio1 has no room left
+  if (!mbm.init_pio(pio1))
+    printf("Modbus PIO backend unavailable, using UART\n");
+#else
   mbm.init();
+#endif
+#if MODBUS_CAPTURE == 1
+  mbm.set_capture(&modbus_capture);
+  modbus_capture.set_enabled(true);
+#endif
+  // Once a slave has answered a few times, give up on it at p99 of its round trip + 5ms instead of timeout_ms
+  mbm.set_adaptive_timeout(true, 5000);
 
   gpio_init(pin_buzzer);
   gpio_init(pin_start);
@@ -209,20 +281,34 @@ void core0_entry() {
   gpio_set_dir(pin_stop, GPIO_IN);
   gpio_set_dir(pin_ac, GPIO_IN);
   gpio_set_dir(pin_dc, GPIO_IN);
-  PZEM017::status_t pzem017_status;
-  ESP32::status_t   esp_status;
-  float             temperature;
 
-  PulseContact    sample_pulse(0.25);
-  Differential_Up sample_up;
+  // The PZEM017 is fixed at 9600 8N2, the ESP32 helper stays on the constructor framing (profile 0)
+  modbus_serial_profile_t pzem_profile;
+  pzem_profile.baud_rate = 9600;
+  pzem_profile.stop_bits = 2;
+  mbm.bind_profile(pzem017_address, mbm.add_profile(pzem_profile));
+
+  // name, slave, function, first register, count, reply length, timeout ms, period ms, priority, deadline ms, callback
+  const modbus_job_t modbus_jobs[] = {
+      {"pzem017", pzem017_address, READ_INPUT_REGISTERS, PZEM017::measurement_map_t::first, PZEM017::measurement_map_t::count,
+       PZEM017::measurement_map_t::response_len, 1000, 250, 0, 250, pzem017_sample_cb},
+      // Temperature and supply status are adjacent, one read covers both
+      {"esp32", esp32_address, READ_HOLDING_REGISTERS, ESP32::inputs_map_t::first, ESP32::inputs_map_t::count, ESP32::inputs_map_t::response_len,
+       100, 500, 1, 500, esp32_inputs_cb},
+  };
+  for (const modbus_job_t &job : modbus_jobs) modbus_scheduler.add_periodic(job);
+
+  PulseContact    stats_pulse(10);
+  Differential_Up stats_up;
 
   while (true) {
-    int setpoint_idx = static_cast<int>(shared_setting_labels_value.setpoint / 5);
-    sample_pulse.service();
-    sample_up.CLK(sample_pulse.Q());
+    Setting_Labels_Value settings     = shared_setting_labels_value.load();
+    int                  setpoint_idx = static_cast<int>(settings.setpoint / 5);
+    stats_pulse.service();
+    stats_up.CLK(stats_pulse.Q());
 
     if (machine_state.started) {
-      int resistance_idx = (int) setting_labels_value.setpoint / 50.;
+      int resistance_idx = (int) settings.setpoint / 50.;
       if (resistance_idx > 0)
         gpio_put(pin_relay0, 0);
       if (resistance_idx > 1)
@@ -232,39 +318,100 @@ void core0_entry() {
       gpio_put(pin_relay1, 1);
     }
 
-    if (sample_up.Q()) {
-      mbm.change_stop_bits(2);
-      if (reset_pzem) {
-        pzem017_status = pzem017.reset_energy();
-        reset_pzem     = false;
-        if (pzem017_status != PZEM017::No_Error)
-          printf("Reset Energy PZEM017 Error: %s\n", pzem017.error_to_string(pzem017_status));
-        shared_big_labels_value.wh = 0;
-      }
-
-      pzem017_status = pzem017.request_all(pzem017_measurement);
-      if (pzem017_status != PZEM017::No_Error) {
-        printf("PZEM017 Error: %s\n", pzem017.error_to_string(pzem017_status));
-      } else {
-        shared_big_labels_value.v  = pzem017_measurement.voltage;
-        shared_big_labels_value.a  = pzem017_measurement.current;
-        shared_big_labels_value.w  = pzem017_measurement.power;
-        shared_big_labels_value.wh = pzem017_measurement.energy;
-
-        // printf("DC Voltage: %f\n", shared_big_labels_value.v);
-        // printf("DC Current: %f\n", shared_big_labels_value.a);
-        // printf("DC Power: %f\n", shared_big_labels_value.w);
-        // printf("DC Energy: %f\n", shared_big_labels_value.wh);
-      }
+    if (reset_pzem) {
+      modbus_job_t reset_job;
+      reset_job.name        = "pzem017_rst";
+      reset_job.slave_addr  = pzem017_address;
+      reset_job.pdu         = &pzem017_reset_pdu;
+      reset_job.resp_len    = 4;
+      reset_job.on_complete = pzem017_reset_cb;
+      if (modbus_scheduler.add_oneshot(reset_job))
+        reset_pzem = false;
+    }
 
-      // mutex_enter_blocking(&shared_data_mutex);
-      shared_status_labels_value.temp = temperature;
-      // mutex_exit(&shared_data_mutex);
+    // Starts the next due job or collects a finished one, never waits for the bus
+    modbus_scheduler.service();
+
+    if (stats_up.Q())
+      modbus_scheduler.print_stats();
+
+#if MODBUS_CAPTURE == 1 || LVGL_PROFILER == 1
+    // USB stdin is only read when a command consumer is built in
+    int command = getchar_timeout_us(0);
+#endif
+#if MODBUS_CAPTURE == 1
+    if (command == 'C') {
+      stdio_flush();
+      modbus_capture.export_to(modbus_capture_put);
+      stdio_flush();
+    } else if (command == 'X') {
+      modbus_capture.clear();
     }
+#endif
+#if LVGL_PROFILER == 1
+    if (command == 'P')
+      lvgl_profiler_request_dump();
+    else if (command == 'Z')
+      lvgl_profiler_reset();
+#endif
   }
   return;
 }
 
+void pzem017_sample_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  PZEM017::status_t status = pzem017.finish_request_all(transaction, pzem017_measurement);
+  if (status != PZEM017::No_Error) {
+    printf("PZEM017 Error: %s\n", pzem017.error_to_string(status));
+    return;
+  }
+  shared_big_labels_value.publish({pzem017_measurement.voltage, pzem017_measurement.current, pzem017_measurement.power, pzem017_measurement.energy});
+  pzem017_trend.push({pzem017_measurement.voltage, pzem017_measurement.current, pzem017_measurement.power});
+}
+
+void pzem017_reset_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  PZEM017::status_t status = pzem017.finish_reset_energy(transaction);
+  if (status != PZEM017::No_Error)
+    printf("Reset Energy PZEM017 Error: %s\n", pzem017.error_to_string(status));
+  Big_Labels_Value big = shared_big_labels_value.load();
+  big.wh               = 0;
+  shared_big_labels_value.publish(big);
+}
+
+void esp32_inputs_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  ESP32::inputs_t inputs;
+  ESP32::status_t status = esp32.finish_request_inputs(transaction, inputs);
+  if (status != ESP32::No_Error)
+    return;
+  machine_state.sensed_source = inputs.sensed_source;
+  esp32_temperature           = inputs.temperature;
+}
+
+// Switches the trend view on request and feeds it the samples core0 pushed since the last loop
+void trend_view_service() {
+  static uint32_t       trend_cursor;
+  static trend_sample_t trend_samples[TREND_VIEW_WIDTH];
+
+  if (lvgl_trend_view_active() && lvgl_trend_view_covered()) {
+    app.set_trend_view(false);
+    trend_view_request = false;
+  }
+  if (trend_view_request && !lvgl_trend_view_active()) {
+    trend_cursor = pzem017_trend.count() - std::min<uint32_t>(pzem017_trend.count(), TREND_VIEW_WIDTH);
+    size_t n     = pzem017_trend.read(trend_cursor, trend_samples, TREND_VIEW_WIDTH);
+    if (!lvgl_trend_view_begin(trend_samples, n)) {
+      app.set_trend_view(false);
+      trend_view_request = false;
+    }
+  } else if (!trend_view_request && lvgl_trend_view_active()) {
+    lvgl_trend_view_end();
+  }
+  if (!lvgl_trend_view_active())
+    return;
+  trend_sample_t sample;
+  while (pzem017_trend.read(trend_cursor, &sample, 1))
+    lvgl_trend_view_push(sample);
+}
+
 void core1_entry() {
   lvgl_display_init();
   app.app_entry();
@@ -288,14 +435,28 @@ void core1_entry() {
   app.set_wifi_list(wifi_list);
   app.attach_wifi_cb(wifi_cb_dummy);
   app.set_wifi_status(is_wifi_connected());
+  // The view is switched from the main loop, not from inside the LVGL click event
+  app.attach_trend_view_cb([](bool on) { trend_view_request = on; });
+#if LVGL_PROFILER == 1
+  app.attach_diagnostics_cb(lvgl_profiler_show);
+#endif
+  // Holding the encoder button opens the touch calibration
+  app.attach_touch_calibration_cb(lvgl_touch_get_raw,
+                                  [](const Touch_Calibration_Points &points) { return lvgl_touch_calibrate(points.raw, points.screen); });
 
   // Initialize HTTP client
   http_client_init();
   last_http_request_time = get_absolute_time();
 
   add_repeating_timer_ms(10, input_service, NULL, &io_service_timer);
-  add_repeating_timer_us(100, encoder_service, NULL, &encoder_service_timer);
-  add_repeating_timer_ms(1000, one_sec_service, NULL, &one_sec_timer);
+  // Rotation is counted by the encoder's GPIO interrupt, this only reads it and times the button
+  add_repeating_timer_ms(ENC_SERVICE_MS, encoder_service, NULL, &encoder_service_timer);
+  // Runs from this loop, it ends the load bank from the status this core publishes
+  absolute_time_t one_sec_due = make_timeout_time_ms(1000);
+
+#if DISPLAY_FLUSH_STATS == 1
+  absolute_time_t flush_stats_due = make_timeout_time_ms(10000);
+#endif
 
   while (true) {
     // Check WiFi scan completion
@@ -304,143 +465,260 @@ void core1_entry() {
     // Process HTTP client when WiFi is connected
     http_client_process();
 
-    // mutex_enter_blocking(&shared_data_mutex);
-    big_labels_value     = shared_big_labels_value;
-    setting_labels_value = shared_setting_labels_value;
-    status_labels_value  = shared_status_labels_value;
-    // mutex_exit(&shared_data_mutex);
+    input_apply();
 
-    app.app_update(big_labels_value, setting_labels_value, status_labels_value);
+    if (time_reached(one_sec_due)) {
+      one_sec_due = delayed_by_ms(one_sec_due, 1000);
+      one_sec_service();
+    }
 
-    lv_timer_handler();
-    sleep_ms(5);
+    Status_Labels_Value status = shared_status_labels_value.load();
+    if (status.temp != esp32_temperature) {
+      status.temp = esp32_temperature;
+      shared_status_labels_value.publish(status);
+    }
+
+    // Any publish changes the sum, app_update() returns right away when it is the same as last time
+    uint32_t labels_version = shared_big_labels_value.version() + shared_setting_labels_value.version() + shared_status_labels_value.version();
+    big_labels_value        = shared_big_labels_value.load();
+    setting_labels_value    = shared_setting_labels_value.load();
+    status_labels_value     = shared_status_labels_value.load();
+    app.app_update(big_labels_value, setting_labels_value, status_labels_value, labels_version);
+
+    // Draws at most once per frame slot, dirty areas from several passes end up in one frame
+    uint32_t idle_us = lvgl_frame_pace();
+    input_latency_update();
+
+    trend_view_service();
+
+#if DISPLAY_FLUSH_STATS == 1
+    if (time_reached(flush_stats_due)) {
+      lvgl_display_print_flush_stats();
+      lvgl_display_reset_flush_stats();
+      lvgl_frame_print_stats();
+      lvgl_frame_reset_stats();
+      input_print_latency();
+      input_reset_latency();
+      flush_stats_due = make_timeout_time_ms(10000);
+    }
+#endif
+    sleep_us(idle_us);
   }
 
   return;
 }
 
-bool one_sec_service(struct repeating_timer *t) {
-  static float last_voltage = shared_big_labels_value.v;  // store the previous voltage value
-  // mutex_enter_blocking(&shared_data_mutex);
-  if (shared_status_labels_value.started) {
-    shared_status_labels_value.time_running++;
-    if (shared_status_labels_value.time_running >= shared_setting_labels_value.timer && shared_setting_labels_value.timer != 0) {
-      shared_status_labels_value.started = false;
-      machine_state.started              = false;
+void one_sec_service() {
+  Big_Labels_Value     big          = shared_big_labels_value.load();
+  Setting_Labels_Value settings     = shared_setting_labels_value.load();
+  Status_Labels_Value  status       = shared_status_labels_value.load();
+  static float         last_voltage = big.v;  // store the previous voltage value
+  if (status.started) {
+    status.time_running++;
+    if (status.time_running >= settings.timer && settings.timer != 0) {
+      status.started        = false;
+      machine_state.started = false;
       app.modal_create_alert("Timer telah berakhir, menghentikan load bank");
     }
-    if (shared_setting_labels_value.cutoff_e != 0 && shared_big_labels_value.wh >= shared_setting_labels_value.cutoff_e) {
-      shared_status_labels_value.started = false;
-      machine_state.started              = false;
+    if (settings.cutoff_e != 0 && big.wh >= settings.cutoff_e) {
+      status.started        = false;
+      machine_state.started = false;
       app.modal_create_alert("Energi telah mencapai batas, menghentikan load bank");
     }
-    if (shared_setting_labels_value.cutoff_v != 0) {
+    if (settings.cutoff_v != 0) {
       // Check for falling edge: previous voltage > cutoff && current voltage <= cutoff
-      if (last_voltage > shared_setting_labels_value.cutoff_v && shared_big_labels_value.v <= shared_setting_labels_value.cutoff_v) {
-        shared_status_labels_value.started = false;
-        machine_state.started              = false;
+      if (last_voltage > settings.cutoff_v && big.v <= settings.cutoff_v) {
+        status.started        = false;
+        machine_state.started = false;
         app.modal_create_alert("Tegangan telah mencapai batas bawah, menghentikan load bank");
       }
     }
     // Update the previous voltage value
-    last_voltage = shared_big_labels_value.v;
+    last_voltage = big.v;
+    shared_status_labels_value.publish(status);
   }
-  // mutex_exit(&shared_data_mutex);
-  return true;
 }
 
 static bool modal_active = false;
 void        start_cb() {
-  machine_state.started                   = true;
-  shared_status_labels_value.started      = true;
-  shared_status_labels_value.time_running = 0;
-  reset_pzem                              = true;
+  Status_Labels_Value status = shared_status_labels_value.load();
+  status.started             = true;
+  status.time_running        = 0;
+  shared_status_labels_value.publish(status);
+  machine_state.started = true;
+  reset_pzem            = true;
 }
 
+static void input_push(Input_Event_Type type, int16_t value) { input_queue.push({time_us_32(), type, value}); }
+
 bool input_service(struct repeating_timer *t) {
-  static Sensed_Source last_ac_dc_off = Source_Off;
-  // mutex_enter_blocking(&shared_data_mutex);
+  static Sensed_Source last_source = Source_Off;
   start.CLK(gpio_get(pin_start));
   stop.CLK(gpio_get(pin_stop));
-  ac_dc_off = (Sensed_Source) ((gpio_get(pin_ac) << 1) | gpio_get(pin_dc));
-
-  if (start.Q() && !modal_active) {
-    if (machine_state.polarity_flipped) {
-      app.modal_create_confirm(nullptr, start_cb, "Apakah anda yakin ingin memulai load bank?", "Polaritas Terbalik", bs_warning);
-    } else if (ac_dc_off == Source_Off) {
-      // app.modal_create_alert("Sumber daya belum dipilih, silahkan pilih sumber daya terlebih dahulu", "Peringatan!");
-      app.modal_create_confirm(nullptr, start_cb, "Sumber daya belum dipilih\nApakah anda yakin ingin memulai load bank?",
-                               "Sumber daya belum dipilih", bs_warning);
-    } else if (ac_dc_off != machine_state.sensed_source) {
-      // app.modal_create_alert("Sumber daya yang dipilih tidak sesuai dengan sumber daya yang terdeteksi");
-      app.modal_create_confirm(nullptr, start_cb,
-                               "Sumber daya yang dipilih tidak sesuai dengan sumber daya yang terdeteksi\nApakah anda yakin ingin memulai load bank?",
-                               "Sumber daya tidak sesuai", bs_warning);
-    } else if (shared_big_labels_value.v == 0) {
-      app.modal_create_alert("Tegangan belum terdeteksi, silahkan cek koneksi tegangan");
-    } else if (shared_big_labels_value.v >= 110) {
-      app.modal_create_alert("Tegangan terdeteksi terlalu tinggi, tidak bisa memulai load bank");
-    } else {
-      start_cb();
-    }
-  }
+  Sensed_Source source = (Sensed_Source) ((gpio_get(pin_ac) << 1) | gpio_get(pin_dc));
+
+  if (start.Q())
+    input_push(Input_Start, 0);
+  if (stop.Q())
+    input_push(Input_Stop, 0);
+  if (source != last_source)
+    input_push(Input_Source, source);
+  last_source = source;
+  return true;
+}
 
-  if (stop.Q()) {
-    machine_state.started              = false;
-    shared_status_labels_value.started = false;
+bool encoder_service(struct repeating_timer *t) {
+  static bool held = false;
+  int16_t     steps = encoder.get_value();
+  if (steps != 0)
+    input_push(Input_Encoder, steps);
+  ClickEncoder::Button button = encoder.get_button();
+  if (button == ClickEncoder::Clicked)
+    input_push(Input_Click, 0);
+  // Held is reported for as long as the button is down, only its start is an event
+  if (button == ClickEncoder::Held && !held)
+    input_push(Input_Held, 0);
+  held = button == ClickEncoder::Held;
+  encoder.service();
+  return true;
+}
+
+static void input_start_pressed() {
+  if (modal_active)
+    return;
+  if (machine_state.polarity_flipped) {
+    app.modal_create_confirm(nullptr, start_cb, "Apakah anda yakin ingin memulai load bank?", "Polaritas Terbalik", bs_warning);
+  } else if (ac_dc_off == Source_Off) {
+    // app.modal_create_alert("Sumber daya belum dipilih, silahkan pilih sumber daya terlebih dahulu", "Peringatan!");
+    app.modal_create_confirm(nullptr, start_cb, "Sumber daya belum dipilih\nApakah anda yakin ingin memulai load bank?",
+                             "Sumber daya belum dipilih", bs_warning);
+  } else if (ac_dc_off != machine_state.sensed_source) {
+    // app.modal_create_alert("Sumber daya yang dipilih tidak sesuai dengan sumber daya yang terdeteksi");
+    app.modal_create_confirm(nullptr, start_cb,
+                             "Sumber daya yang dipilih tidak sesuai dengan sumber daya yang terdeteksi\nApakah anda yakin ingin memulai load bank?",
+                             "Sumber daya tidak sesuai", bs_warning);
+  } else if (shared_big_labels_value.load().v == 0) {
+    app.modal_create_alert("Tegangan belum terdeteksi, silahkan cek koneksi tegangan");
+  } else if (shared_big_labels_value.load().v >= 110) {
+    app.modal_create_alert("Tegangan terdeteksi terlalu tinggi, tidak bisa memulai load bank");
+  } else {
+    start_cb();
   }
-  if (ac_dc_off != last_ac_dc_off) {
-    app.set_source_highlight(ac_dc_off, true);
+}
+
+static void input_encoder_moved(int encoder_delta) {
+  Setting_Labels_Value settings = shared_setting_labels_value.load();
+  switch (app.get_highlighted_setting()) {
+  case Setpoint:
+    settings.setpoint += encoder_delta * 50.0;
+    apply_min_max<float>(settings.setpoint, 0.0, 100.0);
+    break;
+  case Timer:
+    settings.timer += encoder_delta;
+    apply_min_max<int32_t>(settings.timer, 0, 1000000);
+    break;
+  case CutOff_V:
+    settings.cutoff_v += encoder_delta * 0.1;
+    apply_min_max<float>(settings.cutoff_v, 0.0, 300.0);
+    break;
+  case CutOff_E:
+    settings.cutoff_e += encoder_delta * 1.0;
+    apply_min_max<float>(settings.cutoff_e, 0.0, 1000000.0);
+    break;
   }
-  last_ac_dc_off = ac_dc_off;
-  // mutex_exit(&shared_data_mutex);
-  return true;
+  shared_setting_labels_value.publish(settings);
 }
 
-bool encoder_service(struct repeating_timer *t) {
-  static int encoder_value           = 0;
-  static int last_encoder_value      = 0;
+// Applies the queued input in order, once per pass of the core1 loop
+void input_apply() {
   static int undivided_encoder_value = 0;
-  static int encoder_delta           = 0;
-
-  undivided_encoder_value += encoder.get_value();
-  encoder_value                                     = undivided_encoder_value / 4;
-  ClickEncoder::Button b                            = encoder.get_button();
-  encoder_delta                                     = encoder_value - last_encoder_value;
-  Setting_Highlighted_Container highlighted_setting = app.get_highlighted_setting();
-  switch (highlighted_setting) {
+  static int last_encoder_value      = 0;
+
+  // The highlight may also change by touch, the encoder picks the acceleration of the current one
+  switch (app.get_highlighted_setting()) {
   case Setpoint:
     encoder.set_enable_acceleration(false);
-    shared_setting_labels_value.setpoint += encoder_delta * 50.0;
-    apply_min_max<float>(shared_setting_labels_value.setpoint, 0.0, 100.0);
     break;
   case Timer:
     encoder.set_enable_acceleration(true);
     encoder.set_acceleration_properties(300, 5, 64000);
-    shared_setting_labels_value.timer += encoder_delta;
-    apply_min_max<int32_t>(shared_setting_labels_value.timer, 0, 1000000);
     break;
   case CutOff_V:
     encoder.set_enable_acceleration(true);
     encoder.set_acceleration_properties(200, 10, 16000);
-    shared_setting_labels_value.cutoff_v += encoder_delta * 0.1;
-    apply_min_max<float>(shared_setting_labels_value.cutoff_v, 0.0, 300.0);
     break;
   case CutOff_E:
     encoder.set_enable_acceleration(true);
     encoder.set_acceleration_properties(400, 10, 32000);
-    shared_setting_labels_value.cutoff_e += encoder_delta * 1.0;
-    apply_min_max<float>(shared_setting_labels_value.cutoff_e, 0.0, 1000000.0);
     break;
   }
-  if (b == ClickEncoder::Clicked) {
-    highlighted_setting = static_cast<Setting_Highlighted_Container>((highlighted_setting + 1) % 4);
-    app.set_setting_highlight(highlighted_setting, true);
+
+  input_event_t event;
+  while (input_queue.pop(event)) {
+    if (!input_pending) {
+      input_pending    = true;
+      input_pending_us = event.time_us;
+    }
+    switch (event.type) {
+    case Input_Encoder: {
+      undivided_encoder_value += event.value;
+      int encoder_value = undivided_encoder_value / 4;
+      input_encoder_moved(encoder_value - last_encoder_value);
+      last_encoder_value = encoder_value;
+      break;
+    }
+    case Input_Click: {
+      Setting_Highlighted_Container highlighted_setting = app.get_highlighted_setting();
+      highlighted_setting = static_cast<Setting_Highlighted_Container>((highlighted_setting + 1) % 4);
+      app.set_setting_highlight(highlighted_setting, true);
+      break;
+    }
+    case Input_Held:
+      // Works with a touch panel too far off to reach any button
+      app.touch_calibration_screen();
+      break;
+    case Input_Start:
+      input_start_pressed();
+      break;
+    case Input_Stop: {
+      Status_Labels_Value status = shared_status_labels_value.load();
+      status.started             = false;
+      shared_status_labels_value.publish(status);
+      machine_state.started = false;
+      break;
+    }
+    case Input_Source:
+      ac_dc_off = (Sensed_Source) event.value;
+      app.set_source_highlight(ac_dc_off, true);
+      break;
+    }
+  }
+}
+
+// Called after lvgl_frame_pace(), a new frame means the applied input is on its way to the panel
+void input_latency_update() {
+  lvgl_frame_stats_t stats;
+  lvgl_frame_get_stats(stats);
+  if (stats.frames != input_last_frames && input_pending) {
+    uint32_t us = time_us_32() - input_pending_us;
+    input_latency.batches++;
+    input_latency.sum_us += us;
+    input_latency.max_us  = std::max(input_latency.max_us, us);
+    input_pending         = false;
   }
-  last_encoder_value = encoder_value;
-  // mutex_exit(&shared_data_mutex);
-  encoder.service();
-  return true;
+  input_last_frames = stats.frames;
+}
+
+void input_print_latency() {
+  printf("input: %u batches, latency avg %u us max %u us, %u dropped\n", (uint) input_latency.batches,
+         (uint) (input_latency.batches ? input_latency.sum_us / input_latency.batches : 0), (uint) input_latency.max_us,
+         (uint) input_queue.dropped());
+}
+
+// Call together with lvgl_frame_reset_stats()
+void input_reset_latency() {
+  input_latency     = {};
+  input_last_frames = 0;
 }
 
 lv_obj_t *wifi_scan_overlay;
@@ -581,19 +859,19 @@ void check_wifi_scan_completion() {
 }
 
 void changes_cb(EventData *ed) {
-  const char *txt = lv_textarea_get_text(ed->textarea);
-  double      data;
-  // mutex_enter_blocking(&shared_data_mutex);
+  const char          *txt      = lv_textarea_get_text(ed->textarea);
+  double               data;
+  Setting_Labels_Value settings = shared_setting_labels_value.load();
   switch (ed->event_type) {
   case PROPAGATE_CUTOFF_E:
     data = atof(txt);
     apply_min_max<double>(data, 0.0, 1000000.0);
-    shared_setting_labels_value.cutoff_e = data;
+    settings.cutoff_e = data;
     break;
   case PROPAGATE_CUTOFF_V:
     data = atof(txt);
     apply_min_max<double>(data, 0.0, 300.0);
-    shared_setting_labels_value.cutoff_v = data;
+    settings.cutoff_v = data;
     break;
   case PROPAGATE_SETPOINT:
     data = atof(txt);
@@ -604,7 +882,7 @@ void changes_cb(EventData *ed) {
       data = 50.0;
     else
       data = 100.0;
-    shared_setting_labels_value.setpoint = data;
+    settings.setpoint = data;
     break;
   case PROPAGATE_TIMER:
     int hour = 0, minute = 0, second = 0;
@@ -612,10 +890,10 @@ void changes_cb(EventData *ed) {
     apply_min_max<int>(hour, 0, 99);
     apply_min_max<int>(minute, 0, 59);
     apply_min_max<int>(second, 0, 59);
-    shared_setting_labels_value.timer = hour * 3600 + minute * 60 + second;
+    settings.timer = hour * 3600 + minute * 60 + second;
     break;
   }
-  // mutex_exit(&shared_data_mutex);
+  shared_setting_labels_value.publish(settings);
 }
 
 const char *wifi_error_to_string_id(int error_code) {
@@ -708,10 +986,11 @@ err_t http_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
   http_state.connected = true;
   
   // Get current sensor readings
-  float voltage = shared_big_labels_value.v;
-  float current = shared_big_labels_value.a;
-  float power = shared_big_labels_value.w;
-  float energy = shared_big_labels_value.wh;
+  Big_Labels_Value big = shared_big_labels_value.load();
+  float voltage = big.v;
+  float current = big.a;
+  float power = big.w;
+  float energy = big.wh;
   bool is_started = machine_state.started; // Use machine_state.started instead of shared_status_labels_value.started
   
   // Create simplified JSON payload - let server handle timestamp and defaults
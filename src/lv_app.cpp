@@ -203,6 +203,120 @@ void LVGL_App::splash_screen(uint32_t delay) {
   lv_anim_start(&a);
 }
 
+void LVGL_App::set_trend_view(bool on) {
+  trend_view = on;
+  if (!trend_area)
+    return;
+  for (uint32_t i = 0; i < lv_obj_get_child_count(trend_area); i++) {
+    if (on)
+      lv_obj_add_flag(lv_obj_get_child(trend_area, i), LV_OBJ_FLAG_HIDDEN);
+    else
+      lv_obj_remove_flag(lv_obj_get_child(trend_area, i), LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+// State of the touch calibration screen, freed with it
+struct Touch_Calibration_Wizard {
+  LVGL_App                *app;
+  lv_obj_t                *prev;
+  lv_obj_t                *target;
+  lv_obj_t                *label;
+  lv_timer_t              *timer;
+  Touch_Calibration_Points points;
+  uint8_t                  step;
+  uint32_t                 sum_x, sum_y, samples;
+  uint32_t                 close_ticks;
+};
+
+static void touch_calibration_show_step(Touch_Calibration_Wizard *wiz, const char *message) {
+  lv_obj_set_pos(wiz->target, wiz->points.screen[wiz->step][0] - 8, wiz->points.screen[wiz->step][1] - 8);
+  lv_obj_remove_flag(wiz->target, LV_OBJ_FLAG_HIDDEN);
+  lv_label_set_text_fmt(wiz->label, "%s (%d/3)", message, wiz->step + 1);
+  wiz->samples = 0;
+}
+
+void LVGL_App::touch_calibration_screen() {
+  if (!touch_raw_cb || !touch_calibrated_cb)
+    return;
+  static constexpr uint32_t sample_ms   = 20;
+  static constexpr uint32_t min_samples = 5;  // Shorter presses are ignored
+
+  Touch_Calibration_Wizard *wiz = new Touch_Calibration_Wizard();
+  wiz->app                      = this;
+  wiz->prev                     = lv_screen_active();
+  // Spread over the screen and not on a line, so the solved map is well conditioned
+  int32_t w = lv_display_get_horizontal_resolution(NULL);
+  int32_t h = lv_display_get_vertical_resolution(NULL);
+  const uint16_t targets[3][2] = {{(uint16_t) (w / 10), (uint16_t) (h / 10)},
+                                  {(uint16_t) (w * 9 / 10), (uint16_t) (h / 2)},
+                                  {(uint16_t) (w / 2), (uint16_t) (h * 9 / 10)}};
+  memcpy(wiz->points.screen, targets, sizeof(targets));
+
+  lv_obj_t *scr = lv_obj_create(NULL);
+  lv_obj_set_style_bg_color(scr, lv_color_black(), 0);
+  lv_obj_clear_flag(scr, LV_OBJ_FLAG_SCROLLABLE);
+  wiz->label = lv_label_create(scr);
+  lvc_label_init(wiz->label, &lv_font_montserrat_16, LV_ALIGN_CENTER, 0, 0, bs_white);
+  wiz->target = lv_obj_create(scr);
+  lv_obj_set_size(wiz->target, 17, 17);
+  lv_obj_set_style_radius(wiz->target, LV_RADIUS_CIRCLE, 0);
+  lv_obj_set_style_bg_opa(wiz->target, LV_OPA_TRANSP, 0);
+  lv_obj_set_style_border_color(wiz->target, lv_palette_main(LV_PALETTE_RED), 0);
+  lv_obj_set_style_border_width(wiz->target, 2, 0);
+  lv_obj_clear_flag(wiz->target, LV_OBJ_FLAG_CLICKABLE);
+  touch_calibration_show_step(wiz, "Kalibrasi layar sentuh\nTekan pusat lingkaran merah");
+
+  // The pen is read raw, LVGL's own coordinates use the map being replaced
+  wiz->timer = lv_timer_create(
+      [](lv_timer_t *t) {
+        Touch_Calibration_Wizard *wiz = static_cast<Touch_Calibration_Wizard *>(lv_timer_get_user_data(t));
+        if (wiz->close_ticks) {
+          if (--wiz->close_ticks == 0)
+            lv_screen_load_anim(wiz->prev, LV_SCR_LOAD_ANIM_NONE, 0, 0, true);
+          return;
+        }
+        uint16_t x, y;
+        if (wiz->app->touch_raw_cb(x, y)) {
+          if (wiz->samples == 0)
+            wiz->sum_x = wiz->sum_y = 0;
+          wiz->sum_x += x;
+          wiz->sum_y += y;
+          wiz->samples++;
+          return;
+        }
+        if (wiz->samples < min_samples) {
+          wiz->samples = 0;
+          return;
+        }
+        wiz->points.raw[wiz->step][0] = wiz->sum_x / wiz->samples;
+        wiz->points.raw[wiz->step][1] = wiz->sum_y / wiz->samples;
+        if (++wiz->step < 3) {
+          touch_calibration_show_step(wiz, "Kalibrasi layar sentuh\nTekan pusat lingkaran merah");
+          return;
+        }
+        if (wiz->app->touch_calibrated_cb(wiz->points)) {
+          lv_obj_add_flag(wiz->target, LV_OBJ_FLAG_HIDDEN);
+          lv_label_set_text(wiz->label, "Kalibrasi tersimpan");
+          wiz->close_ticks = 1000 / sample_ms;
+        } else {
+          // Points on a line or a bad press, start over
+          wiz->step = 0;
+          touch_calibration_show_step(wiz, "Kalibrasi gagal, ulangi\nTekan pusat lingkaran merah");
+        }
+      },
+      sample_ms, wiz);
+
+  lv_obj_add_event_cb(
+      scr,
+      [](lv_event_t *e) {
+        Touch_Calibration_Wizard *wiz = static_cast<Touch_Calibration_Wizard *>(lv_event_get_user_data(e));
+        lv_timer_delete(wiz->timer);
+        delete wiz;
+      },
+      LV_EVENT_DELETE, wiz);
+  lv_screen_load_anim(scr, LV_SCR_LOAD_ANIM_NONE, 0, 0, false);
+}
+
 lv_obj_t *LVGL_App::create_row_container(lv_obj_t *parent, int flex_grow, std::function<void(lv_obj_t *)> create_child_cb) {
   lv_obj_t *row_container = lv_obj_create(parent);
 
@@ -275,6 +389,14 @@ void LVGL_App::home_screen(uint32_t delay) {
   lv_obj_set_style_pad_all(top_grid, 0, LV_PART_MAIN);
   lv_obj_set_style_pad_hor(top_grid, 10, LV_PART_MAIN);
   lv_obj_set_style_border_width(top_grid, 0, LV_PART_MAIN);
+  lv_obj_add_event_cb(
+      top_grid,
+      [](lv_event_t *e) {
+        LVGL_App *app = static_cast<LVGL_App *>(lv_event_get_user_data(e));
+        if (app->diagnostics_cb)
+          app->diagnostics_cb();
+      },
+      LV_EVENT_LONG_PRESSED, this);
 
   // Temperature label
   lv_obj_t *temp_label = lv_label_create(top_grid);
@@ -476,6 +598,26 @@ void LVGL_App::home_screen(uint32_t delay) {
     });
   });
 
+  // A tap anywhere on the measurement column toggles the trend view in its place
+  trend_area = left_ctr_grid;
+  lv_obj_tree_walk(
+      left_ctr_grid,
+      [](lv_obj_t *obj, void *user_data) {
+        if (obj != user_data)
+          lv_obj_add_flag(obj, LV_OBJ_FLAG_EVENT_BUBBLE);
+        return LV_OBJ_TREE_WALK_NEXT;
+      },
+      left_ctr_grid);
+  lv_obj_add_event_cb(
+      left_ctr_grid,
+      [](lv_event_t *e) {
+        LVGL_App *app = static_cast<LVGL_App *>(lv_event_get_user_data(e));
+        app->set_trend_view(!app->trend_view);
+        if (app->trend_view_cb)
+          app->trend_view_cb(app->trend_view);
+      },
+      LV_EVENT_CLICKED, this);
+
   lv_obj_t *right_ctr_grid = lv_obj_create(center_grid);
   lv_obj_set_size(right_ctr_grid, lv_pct(50),
                   lv_pct(100));  // Set the size of the grid
@@ -697,11 +839,18 @@ void LVGL_App::home_screen(uint32_t delay) {
 }
 
 void LVGL_App::app_update(const Big_Labels_Value &big_labels_value, const Setting_Labels_Value &setting_labels_value,
-                          const Status_Labels_Value &status_labels_value) {
+                          const Status_Labels_Value &status_labels_value, uint32_t version) {
   static Big_Labels_Value     prev_big_labels_value;
   static Setting_Labels_Value prev_setting_labels_value;
   static Status_Labels_Value  prev_status_labels_value;
   static char                 temp_str[64];
+  static bool                 updated      = false;
+  static uint32_t             prev_version = 0;
+
+  if (updated && version == prev_version)
+    return;
+  updated      = true;
+  prev_version = version;
 
   if (big_labels_value.v != prev_big_labels_value.v) {
     snprintf(temp_str, sizeof(temp_str), "%.2f", big_labels_value.v);
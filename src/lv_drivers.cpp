@@ -1,14 +1,72 @@
 #include "lv_drivers.h"
+#include "lv_image_rle.h"
+
+#include "src/lvgl_private.h"
+
+#include "hardware/flash.h"
+#include "pico/flash.h"
+
+#include <math.h>
+#include <string.h>
 
 // Display buffer configuration
 #define DISP_HOR_RES 480
 #define DISP_VER_RES 320
-#define DISP_BUF_SIZE (DISP_HOR_RES * 10) // 40 lines buffer
-#define BYTE_PER_PIXEL (LV_COLOR_FORMAT_GET_SIZE(LV_COLOR_FORMAT_RGB888))
+// Two stripe buffers: LVGL renders into one while DMA sends the other.
+// At 62.5 MHz a 480 px line takes ~185 us on SPI (3 bytes per pixel in either
+// colour format), about what a line of the setting modal takes to render, so
+// neither side waits long. 16 lines keeps the per stripe set_window and IRQ
+// cost under 1% and divides 320 into 20 stripes. Check
+// lvgl_display_print_flush_stats() before changing it.
+#ifndef DISP_BUF_LINES
+#define DISP_BUF_LINES 16
+#endif
+#define DISP_BUF_SIZE (DISP_HOR_RES * DISP_BUF_LINES)
+// LVGL renders RGB565 and the driver expands it to 18 bit in PIO. Without a
+// free state machine it falls back to RGB888, the same bytes then hold fewer
+// lines per stripe.
+#define BYTE_PER_PIXEL (LV_COLOR_FORMAT_GET_SIZE(LV_COLOR_FORMAT_RGB565))
+
+// Frames per second lvgl_frame_pace() aims for. A slot is the most whole
+// panel refreshes that fit in 1 / LVGL_TARGET_FPS, 2 (~35 fps) for 30.
+#ifndef LVGL_TARGET_FPS
+#define LVGL_TARGET_FPS 30
+#endif
+// Refresh period of the panel when TE is not wired, ~70 Hz with the
+// FRMCTR1 reset value init() leaves in place
+#define PANEL_FRAME_US 14300
+// Dirty areas are drawn as their bounding box when it is at most this much
+// larger, in percent, than the areas themselves. One window and stripe run
+// beats several small ones.
+#define COALESCE_PCT 125
 
 LV_ATTRIBUTE_MEM_ALIGN
-static uint8_t disp_buf[DISP_BUF_SIZE * BYTE_PER_PIXEL];
+static uint8_t disp_buf[2][DISP_BUF_SIZE * BYTE_PER_PIXEL];
 lv_display_t *disp;
+
+static lvgl_flush_stats_t flush_stats;
+static uint32_t render_mark_us;  // Start of the stripe being rendered
+static uint32_t wait_mark_us;    // Start of a stall on the other buffer
+static uint32_t flush_mark_us;   // Entry of disp_flush
+static volatile uint32_t dma_start_us;
+
+static lvgl_frame_stats_t frame_stats;
+static uint32_t frame_period_us;
+static uint32_t next_frame_us;
+static uint32_t frame_mark_us;
+static bool frame_dirty;
+
+#if LVGL_PROFILER == 1
+static lvgl_histogram_t prof_hist[PROF_METRIC_COUNT];
+static lvgl_flush_stats_t prof_frame_start; // flush_stats at REFR_START
+static uint32_t prof_heap_due_us;
+static volatile bool prof_dump_requested;
+static void prof_record(lvgl_profiler_metric_t metric, uint32_t value);
+static void prof_dump();
+#endif
+static uint32_t target_fps = LVGL_TARGET_FPS;
+static volatile uint32_t te_last_us;
+static volatile uint32_t te_period_us = PANEL_FRAME_US;
 static repeating_timer lv_tick_timer;
 
 uint8_t tft_tx = 11;
@@ -18,6 +76,7 @@ uint8_t tft_sck = 10;
 uint8_t tft_cs = 13;
 uint8_t tft_dc = 12;
 uint8_t tft_reset = 9;
+int8_t tft_te = -1; // Not wired on this board
 spi_inst_t *tft_spi = spi1;
 spi_inst_t *touch_spi = spi0;
 
@@ -28,38 +87,120 @@ uint8_t T_DO = 0;
 uint8_t T_IRQ = 1;
 
 constexpr float tft_freq_mhz = 62.5;
+// The PIO bus clocks at up to clk_sys / 2, raise clk_sys to go past 62.5 MHz
+constexpr float tft_pio_freq_mhz = 62.5;
 
 static ILI9486Drivers tft(tft_spi, tft_cs, tft_dc, tft_reset, tft_tx, tft_rx,
                            tft_sck, tft_freq_mhz * 1000 * 1000);
 
 static XPT2046 touch(touch_spi, T_DIN, T_DO, T_CLK, T_CS, T_IRQ);
+static bool touch_sampled = false;
+
+// Touch calibration record in the last flash sector, nothing else of this
+// build uses it
+#define TOUCH_CAL_MAGIC 0x314C4354 // "TCL1"
+#define TOUCH_CAL_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+struct touch_cal_record_t {
+  uint32_t magic;
+  XPT2046::Calibration cal;
+  uint32_t check;
+};
+static bool touch_calibrated = false;
+static bool touch_cal_load();
 
 static void disp_flush(lv_display_t *dispf, const lv_area_t *area,
                        uint8_t *px_map);
 static void touch_cb(lv_indev_t *indev, lv_indev_data_t *data);
+static void flush_timing_cb(lv_event_t *e);
+static void trend_invalidate_cb(lv_event_t *e);
+static void frame_event_cb(lv_event_t *e);
+static void te_irq_handler();
 
-void lvgl_display_init() {
-  tft.init();
-  tft.set_rotation(LANDSCAPE);
-  touch.begin(LANDSCAPE);
+// Trend view state. Columns are kept by native row (screen x while unscrolled),
+// trend_line is the row shown leftmost and the next one to overwrite.
+static bool trend_active;
+static volatile bool trend_covered;
+static uint16_t trend_line;
+static trend_sample_t trend_samples[TREND_VIEW_WIDTH];
+static trend_sample_t trend_scale;
+static lv_color_t trend_column[DISP_VER_RES];
+
+// Draw unit handing large opaque fills to the driver's DMA memory fill, like
+// LVGL's own DMA2D unit. Only full width areas of an RGB565 stripe are taken
+// so the fill is one contiguous run, the rest stays with the SW renderer.
+#define DRAW_UNIT_ID_DMA_FILL 20
+#define DMA_FILL_MIN_PX 2048
 
+struct dma_fill_unit_t {
+  lv_draw_unit_t base_unit;
+  lv_draw_task_t *task_act;
+};
+
+static int32_t dma_fill_evaluate_cb(lv_draw_unit_t *draw_unit,
+                                    lv_draw_task_t *task);
+static int32_t dma_fill_dispatch_cb(lv_draw_unit_t *draw_unit,
+                                    lv_layer_t *layer);
+
+void lvgl_display_init() {
+  // Before init() so the boot clear already goes out by DMA
   tft.dma_init([]() {
-    lv_display_flush_ready(disp);
+    // Release CS before LVGL may start the next set_window
     tft.end_transaction();
+    flush_stats.spi_us += time_us_32() - dma_start_us;
+    lv_display_flush_ready(disp);
   });
+  tft.init();
+  tft.set_rotation(LANDSCAPE);
+  touch.begin(LANDSCAPE);
+  touch_calibrated = touch_cal_load();
+  // PENIRQ started bursts filter the point in the background, touch_cb only
+  // loads it
+  touch_sampled = touch.start_sampling();
+  if (!touch_sampled)
+    printf("XPT2046: no DMA for background sampling, reading on demand\n");
+  // The CYW43 driver and the Modbus port share the PIO blocks, the bus
+  // program goes first as it takes the CPU out of every flush
+  const uint32_t pio_hz = tft_pio_freq_mhz * 1000 * 1000;
+  if (!tft.pio_init(pio0, pio_hz) && !tft.pio_init(pio1, pio_hz))
+    printf("ILI9486: no PIO for the bus, using SPI%u\n", spi_get_index(tft_spi));
+  if (!tft.rgb565_init(pio0) && !tft.rgb565_init(pio1))
+    printf("ILI9486: no PIO for RGB565, rendering RGB888\n");
 
   // Initialize LVGL
   lv_init();
+  lv_image_rle_init();
+
+  dma_fill_unit_t *fill_unit =
+      (dma_fill_unit_t *)lv_draw_create_unit(sizeof(dma_fill_unit_t));
+  fill_unit->base_unit.evaluate_cb = dma_fill_evaluate_cb;
+  fill_unit->base_unit.dispatch_cb = dma_fill_dispatch_cb;
 
   // Set up display buffer
   disp = lv_display_create(DISP_HOR_RES, DISP_VER_RES);
-  //   lv_display_set_draw_buffers(disp, disp_buf, nullptr, DISP_BUF_SIZE);
-  lv_display_set_buffers(disp, disp_buf, nullptr, sizeof(disp_buf),
+  lv_display_set_color_format(disp, tft.is_rgb565_used()
+                                        ? LV_COLOR_FORMAT_RGB565
+                                        : LV_COLOR_FORMAT_RGB888);
+  lv_display_set_buffers(disp, disp_buf[0], disp_buf[1], sizeof(disp_buf[0]),
                          LV_DISPLAY_RENDER_MODE_PARTIAL);
+  lv_display_add_event_cb(disp, flush_timing_cb, LV_EVENT_ALL, nullptr);
+  lv_display_add_event_cb(disp, trend_invalidate_cb, LV_EVENT_INVALIDATE_AREA,
+                          nullptr);
+  lv_display_add_event_cb(disp, frame_event_cb, LV_EVENT_ALL, nullptr);
+  // Frames are started by lvgl_frame_pace(), not by the refresh timer
+  lv_display_delete_refr_timer(disp);
+
+  if (tft_te >= 0) {
+    tft.set_tearing_effect(true);
+    gpio_init(tft_te);
+    gpio_set_dir(tft_te, GPIO_IN);
+    gpio_add_raw_irq_handler(tft_te, te_irq_handler);
+    gpio_set_irq_enabled(tft_te, GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+  }
+  lvgl_frame_pacing_set_fps(target_fps);
 
   // Configure display driver
   lv_display_set_flush_cb(disp, disp_flush);
-  lv_display_set_color_format(disp, LV_COLOR_FORMAT_RGB888);
   lv_display_flush_ready(disp);
 
   // Initialize LVGL input device
@@ -83,17 +224,562 @@ static void disp_flush(lv_display_t *dispf, const lv_area_t *area,
                        uint8_t *px_map) {
   uint32_t num_pixels = (area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1);
 
+  flush_stats.flushes++;
+  flush_stats.pixels += num_pixels;
+  // Only a full screen redraw after the invalidation buffer overflowed gets
+  // past trend_invalidate_cb
+  if (trend_active && area->x1 < TREND_VIEW_WIDTH)
+    trend_covered = true;
   tft.set_address_window(area->x1, area->y1, area->x2 - area->x1 + 1,
                        area->y2 - area->y1 + 1);
   tft.start_transaction();
-  tft.push_colors_dma(reinterpret_cast<uint32_t *>(px_map), num_pixels);
+  dma_start_us = time_us_32();
+  flush_stats.setup_us += dma_start_us - flush_mark_us;
+  if (tft.is_rgb565_used())
+    tft.push_colors_dma(reinterpret_cast<uint16_t *>(px_map), num_pixels);
+  else
+    tft.push_colors_dma(reinterpret_cast<uint32_t *>(px_map), num_pixels);
 }
 
-static void touch_cb(lv_indev_t *indev, lv_indev_data_t *data) {
+// With two buffers LVGL emits, per stripe: render, FLUSH_WAIT_START/FINISH
+// around the wait for the other buffer, FLUSH_START, disp_flush, FLUSH_FINISH.
+static void flush_timing_cb(lv_event_t *e) {
+  uint32_t now = time_us_32();
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_RENDER_START:
+  case LV_EVENT_FLUSH_FINISH:
+    render_mark_us = now;
+    break;
+  case LV_EVENT_FLUSH_WAIT_START:
+    flush_stats.render_us += now - render_mark_us;
+    wait_mark_us = now;
+    break;
+  case LV_EVENT_FLUSH_WAIT_FINISH:
+    flush_stats.wait_us += now - wait_mark_us;
+    render_mark_us = now;
+    break;
+  case LV_EVENT_FLUSH_START:
+    flush_stats.render_us += now - render_mark_us;
+    flush_mark_us = now;
+    break;
+  default:
+    break;
+  }
+}
+
+// Keeps LVGL out of the scroll area, its rows no longer match screen x. The
+// event can't drop an area, one inside the band shrinks to a pixel next to it.
+static void trend_invalidate_cb(lv_event_t *e) {
+  if (!trend_active)
+    return;
+  lv_area_t *area = (lv_area_t *)lv_event_get_param(e);
+  if (area->x1 == 0 && area->x2 == DISP_HOR_RES - 1)
+    trend_covered = true;
+  if (area->x1 < TREND_VIEW_WIDTH)
+    area->x1 = TREND_VIEW_WIDTH;
+  if (area->x2 < area->x1)
+    area->x2 = area->x1;
+}
+
+static bool dma_fill_area(lv_draw_task_t *task, lv_area_t &area) {
+  lv_layer_t *layer = ((lv_draw_dsc_base_t *)task->draw_dsc)->layer;
+  if (!lv_area_intersect(&area, &task->area, &task->clip_area))
+    return false;
+  int32_t w = lv_area_get_width(&area);
+  return w == lv_area_get_width(&layer->buf_area) &&
+         lv_draw_buf_width_to_stride(w, LV_COLOR_FORMAT_RGB565) ==
+             (uint32_t)w * 2;
+}
+
+static int32_t dma_fill_evaluate_cb(lv_draw_unit_t *draw_unit,
+                                    lv_draw_task_t *task) {
+  if (task->type != LV_DRAW_TASK_TYPE_FILL)
+    return 0;
+  lv_draw_fill_dsc_t *dsc = (lv_draw_fill_dsc_t *)task->draw_dsc;
+  lv_area_t area;
+  if (dsc->radius != 0 || dsc->grad.dir != LV_GRAD_DIR_NONE ||
+      dsc->opa < LV_OPA_MAX ||
+      dsc->base.layer->color_format != LV_COLOR_FORMAT_RGB565 ||
+      !dma_fill_area(task, area) || lv_area_get_size(&area) < DMA_FILL_MIN_PX)
+    return 0;
+
+  task->preferred_draw_unit_id = DRAW_UNIT_ID_DMA_FILL;
+  task->preference_score = 0;
+  return 0;
+}
+
+static int32_t dma_fill_dispatch_cb(lv_draw_unit_t *draw_unit,
+                                    lv_layer_t *layer) {
+  dma_fill_unit_t *unit = (dma_fill_unit_t *)draw_unit;
+
+  if (unit->task_act) {
+    if (tft.dma_fill16_busy())
+      return LV_DRAW_UNIT_IDLE;
+    unit->task_act->state = LV_DRAW_TASK_STATE_READY;
+    unit->task_act = nullptr;
+  }
+
+  lv_draw_task_t *t =
+      lv_draw_get_next_available_task(layer, nullptr, DRAW_UNIT_ID_DMA_FILL);
+  if (t == nullptr || lv_draw_layer_alloc_buf(layer) == nullptr)
+    return LV_DRAW_UNIT_IDLE;
+
+  lv_area_t area;
+  dma_fill_area(t, area);
+  t->state = LV_DRAW_TASK_STATE_IN_PROGRESS;
+  unit->task_act = t;
+  lv_draw_fill_dsc_t *dsc = (lv_draw_fill_dsc_t *)t->draw_dsc;
+  tft.dma_fill16(lv_draw_layer_go_to_xy(layer, area.x1 - layer->buf_area.x1,
+                                        area.y1 - layer->buf_area.y1),
+                 lv_color_to_u16(dsc->color), lv_area_get_size(&area));
+  lv_draw_dispatch_request();
+  return 1;
+}
+
+void lvgl_display_get_flush_stats(lvgl_flush_stats_t &stats) {
+  stats = flush_stats;
+}
+
+void lvgl_display_reset_flush_stats() { flush_stats = {}; }
+
+void lvgl_display_print_flush_stats() {
+  lvgl_flush_stats_t s = flush_stats;
+  if (s.flushes == 0 || s.pixels == 0)
+    return;
+  uint32_t lines = s.pixels / DISP_HOR_RES;
+  if (lines == 0)
+    lines = 1;
+  printf("flush: %u stripes, %u lines, render %u us/line, spi %u us/line, "
+         "setup %u us/stripe, stalled %u us\n",
+         (uint)s.flushes, (uint)lines, (uint)(s.render_us / lines),
+         (uint)(s.spi_us / lines), (uint)(s.setup_us / s.flushes),
+         (uint)s.wait_us);
+}
+
+// Columns go out with blocking writes between LVGL flushes
+static void trend_wait_flush() {
+  while (disp->flushing)
+    tight_loop_contents();
+}
+
+// 1, 2, 5 steps with some headroom over the largest value
+static float trend_fit_scale(float value) {
+  static const float steps[] = {1, 2, 5};
+  float decade = 1;
+  while (true) {
+    for (float m : steps)
+      if (value * 1.1f <= decade * m)
+        return decade * m;
+    decade *= 10;
+  }
+}
+
+static int32_t trend_y(float value, float scale) {
+  int32_t y = (int32_t)(value / scale * (DISP_VER_RES - 1));
+  return DISP_VER_RES - 1 - LV_CLAMP(0, y, DISP_VER_RES - 1);
+}
+
+static void trend_trace(float from, float to, float scale, lv_color_t color) {
+  if (isnan(from))
+    from = to;
+  int32_t y0 = trend_y(from, scale);
+  int32_t y1 = trend_y(to, scale);
+  for (int32_t y = LV_MIN(y0, y1); y <= LV_MAX(y0, y1); y++)
+    trend_column[y] = color;
+}
+
+// Draws native row line from its sample and the one left of it on screen
+static void trend_write_column(uint16_t line) {
+  const trend_sample_t &cur = trend_samples[line];
+  const trend_sample_t &prev =
+      line == trend_line
+          ? cur
+          : trend_samples[(line + TREND_VIEW_WIDTH - 1) % TREND_VIEW_WIDTH];
+  lv_color_t grid = lv_color_hex(0x303030);
+  for (int32_t y = 0; y < DISP_VER_RES; y++)
+    trend_column[y] = y % (DISP_VER_RES / 4) == 0 ? grid : lv_color_black();
+  if (!isnan(cur.v)) {
+    trend_trace(prev.w, cur.w, trend_scale.w,
+                lv_palette_main(LV_PALETTE_PURPLE));
+    trend_trace(prev.a, cur.a, trend_scale.a, lv_palette_main(LV_PALETTE_CYAN));
+    trend_trace(prev.v, cur.v, trend_scale.v,
+                lv_palette_main(LV_PALETTE_YELLOW));
+  }
+  tft.set_address_window(line, 0, 1, DISP_VER_RES);
+  tft.push_colors(reinterpret_cast<uint32_t *>(trend_column), DISP_VER_RES);
+}
+
+static bool trend_fit(const trend_sample_t &s) {
+  if (isnan(s.v) ||
+      (s.v <= trend_scale.v && s.a <= trend_scale.a && s.w <= trend_scale.w))
+    return true;
+  trend_scale.v = trend_fit_scale(LV_MAX(s.v, trend_scale.v));
+  trend_scale.a = trend_fit_scale(LV_MAX(s.a, trend_scale.a));
+  trend_scale.w = trend_fit_scale(LV_MAX(s.w, trend_scale.w));
+  return false;
+}
+
+bool lvgl_trend_view_begin(const trend_sample_t *history, size_t count) {
+  if (trend_active)
+    return true;
+  if (tft.rotation() != LANDSCAPE)
+    return false;
+  // Pending areas may still cover the band, send them before it scrolls
+  lv_display_refr_timer(nullptr);
+  trend_wait_flush();
+
+  trend_scale = {0, 0, 0};
+  for (uint16_t i = 0; i < TREND_VIEW_WIDTH; i++) {
+    if (i + count >= TREND_VIEW_WIDTH)
+      trend_samples[i] = history[i + count - TREND_VIEW_WIDTH];
+    else
+      trend_samples[i] = {NAN, NAN, NAN};
+    trend_fit(trend_samples[i]);
+  }
+  trend_fit({1, 1, 1});
+
+  tft.set_scroll_area(0, TREND_VIEW_WIDTH, DISP_HOR_RES - TREND_VIEW_WIDTH);
+  tft.set_scroll_start(0);
+  trend_line = 0;
+  for (uint16_t line = 0; line < TREND_VIEW_WIDTH; line++)
+    trend_write_column(line);
+  trend_covered = false;
+  trend_active = true;
+  return true;
+}
+
+void lvgl_trend_view_push(const trend_sample_t &sample) {
+  if (!trend_active)
+    return;
+  trend_wait_flush();
+  uint16_t line = trend_line;
+  trend_samples[line] = sample;
+  trend_line = (line + 1) % TREND_VIEW_WIDTH;
+  if (trend_fit(sample)) {
+    // The oldest column becomes the newest, one column and one command
+    trend_write_column(line);
+  } else {
+    for (uint16_t l = 0; l < TREND_VIEW_WIDTH; l++)
+      trend_write_column(l);
+  }
+  tft.set_scroll_start(trend_line);
+}
 
-  if (touch.is_touched()) {
-    uint16_t x, y;
-    touch.get_touch(x, y);
+void lvgl_trend_view_end() {
+  if (!trend_active)
+    return;
+  trend_wait_flush();
+  tft.scroll_reset();
+  trend_active = false;
+  trend_covered = false;
+  lv_obj_invalidate(lv_screen_active());
+}
+
+bool lvgl_trend_view_active() { return trend_active; }
+
+bool lvgl_trend_view_covered() { return trend_covered; }
+
+static void te_irq_handler() {
+  if (!(gpio_get_irq_event_mask(tft_te) & GPIO_IRQ_EDGE_RISE))
+    return;
+  gpio_acknowledge_irq(tft_te, GPIO_IRQ_EDGE_RISE);
+  uint32_t now = time_us_32();
+  uint32_t period = now - te_last_us;
+  // Ignore the first edge and any after a missed one
+  if (period > PANEL_FRAME_US / 2 && period < PANEL_FRAME_US * 2)
+    te_period_us = (te_period_us * 7 + period) / 8;
+  te_last_us = now;
+  frame_stats.te_edges++;
+}
+
+// With TE the slot moves to the next refresh start, without it only the
+// period is known
+static uint32_t frame_align(uint32_t t) {
+  if (tft_te < 0 || t - te_last_us > 4 * te_period_us)
+    return t;
+  uint32_t period = te_period_us;
+  uint32_t refreshes = (t - te_last_us + period - 1) / period;
+  return te_last_us + refreshes * period;
+}
+
+// Follows te_period_us as the TE measurement settles
+static void frame_update_period() {
+  uint32_t period = te_period_us;
+  uint32_t refreshes = LV_MAX(1000000 / target_fps / period, 1u);
+  frame_period_us = refreshes * period;
+}
+
+void lvgl_frame_pacing_set_fps(uint32_t fps) {
+  target_fps = LV_MAX(fps, 1u);
+  frame_update_period();
+  next_frame_us = frame_align(time_us_32());
+}
+
+uint32_t lvgl_frame_pace() {
+  // Input, animations and app timers, these only invalidate areas
+#if LVGL_PROFILER == 1
+  uint32_t timers_start = time_us_32();
+#endif
+  uint32_t timer_ms = lv_timer_handler();
+
+  uint32_t now = time_us_32();
+#if LVGL_PROFILER == 1
+  prof_record(PROF_TIMERS_US, now - timers_start);
+  if ((int32_t)(now - prof_heap_due_us) >= 0) {
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    prof_record(PROF_HEAP_USED, mon.total_size - mon.free_size);
+    prof_heap_due_us = now + 1000000;
+  }
+  if (prof_dump_requested) {
+    prof_dump_requested = false;
+    prof_dump();
+  }
+#endif
+  if ((int32_t)(now - next_frame_us) >= 0) {
+    frame_update_period();
+    uint32_t missed = (now - next_frame_us) / frame_period_us;
+    frame_stats.skipped += missed;
+    next_frame_us = frame_align(next_frame_us + (missed + 1) * frame_period_us);
+    if (disp->inv_p)
+      lv_display_refr_timer(nullptr);
+    now = time_us_32();
+  }
+
+  int32_t sleep_us = next_frame_us - now;
+  if (sleep_us < 0)
+    return 0;
+  if (timer_ms != LV_NO_TIMER_READY)
+    sleep_us = LV_MIN((uint32_t)sleep_us, timer_ms * 1000);
+  return sleep_us;
+}
+
+// Merges the frame's dirty areas into their bounding box when that adds
+// little, LVGL itself only joins areas that overlap.
+static void frame_coalesce() {
+  if (disp->inv_p < 2)
+    return;
+  lv_area_t box = disp->inv_areas[0];
+  uint32_t px = 0;
+  for (uint32_t i = 0; i < disp->inv_p; i++) {
+    lv_area_join(&box, &box, &disp->inv_areas[i]);
+    px += lv_area_get_size(&disp->inv_areas[i]);
+  }
+  if ((uint64_t)lv_area_get_size(&box) * 100 > (uint64_t)px * COALESCE_PCT)
+    return;
+  disp->inv_areas[0] = box;
+  disp->inv_p = 1;
+  frame_stats.coalesced++;
+}
+
+static void frame_event_cb(lv_event_t *e) {
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_REFR_START:
+    // LVGL still sends REFR_START and REFR_READY with nothing to draw
+    frame_dirty = disp->inv_p != 0;
+    frame_mark_us = time_us_32();
+    frame_coalesce();
+#if LVGL_PROFILER == 1
+    prof_frame_start = flush_stats;
+    if (frame_dirty)
+      prof_record(PROF_DIRTY_AREAS, disp->inv_p);
+#endif
+    break;
+  case LV_EVENT_REFR_READY: {
+    if (!frame_dirty)
+      break;
+    uint32_t us = time_us_32() - frame_mark_us;
+    frame_stats.frames++;
+    frame_stats.frame_us += us;
+    frame_stats.frame_max_us = LV_MAX(frame_stats.frame_max_us, us);
+#if LVGL_PROFILER == 1
+    // The flush path already sums these, a frame is the difference
+    prof_record(PROF_RENDER_US,
+                flush_stats.render_us - prof_frame_start.render_us);
+    prof_record(PROF_DMA_WAIT_US,
+                flush_stats.wait_us - prof_frame_start.wait_us);
+    prof_record(PROF_FLUSH_BYTES,
+                (flush_stats.pixels - prof_frame_start.pixels) * 3);
+#endif
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void lvgl_frame_get_stats(lvgl_frame_stats_t &stats) { stats = frame_stats; }
+
+void lvgl_frame_reset_stats() { frame_stats = {}; }
+
+void lvgl_frame_print_stats() {
+  lvgl_frame_stats_t s = frame_stats;
+  printf("frames: %u drawn, %u skipped, %u coalesced, %u us avg, %u us max, "
+         "%u fps target, %u us slot, %u TE edges\n",
+         (uint)s.frames, (uint)s.skipped, (uint)s.coalesced,
+         (uint)(s.frames ? s.frame_us / s.frames : 0), (uint)s.frame_max_us,
+         (uint)target_fps, (uint)frame_period_us, (uint)s.te_edges);
+}
+
+#if LVGL_PROFILER == 1
+static const char *const prof_names[PROF_METRIC_COUNT] = {
+    "timers us", "render us", "dma wait us", "flush B", "areas", "heap B"};
+
+static void prof_record(lvgl_profiler_metric_t metric, uint32_t value) {
+  lvgl_histogram_t &h = prof_hist[metric];
+  uint32_t bin = value ? 32 - __builtin_clz(value) : 0;
+  h.bins[LV_MIN(bin, LVGL_HISTOGRAM_BINS - 1u)]++;
+  h.count++;
+  h.sum += value;
+  h.max = LV_MAX(h.max, value);
+}
+
+// Upper bound of the bin holding the pct percentile
+static uint32_t prof_percentile(const lvgl_histogram_t &h, uint32_t pct) {
+  uint32_t rank = (uint32_t)(((uint64_t)h.count * pct + 99) / 100);
+  uint32_t seen = 0;
+  for (uint32_t bin = 0; bin < LVGL_HISTOGRAM_BINS; bin++) {
+    seen += h.bins[bin];
+    if (seen >= rank && seen)
+      return bin ? LV_MIN((1u << bin) - 1, h.max) : 0;
+  }
+  return h.max;
+}
+
+// One line per metric: samples, average, p50, p95 and max
+static size_t prof_format(char *buf, size_t size) {
+  size_t len = 0;
+  for (uint32_t m = 0; m < PROF_METRIC_COUNT && len < size; m++) {
+    const lvgl_histogram_t &h = prof_hist[m];
+    len += snprintf(buf + len, size - len, "%-11s n %-6u avg %-6u p50 %-6u "
+                    "p95 %-6u max %u\n",
+                    prof_names[m], (uint)h.count,
+                    (uint)(h.count ? h.sum / h.count : 0),
+                    (uint)prof_percentile(h, 50), (uint)prof_percentile(h, 95),
+                    (uint)h.max);
+  }
+  return len;
+}
+
+// Raw bins too, for plotting on the host
+static void prof_dump() {
+  static char text[512];
+  prof_format(text, sizeof(text));
+  printf("profiler:\n%s", text);
+  for (uint32_t m = 0; m < PROF_METRIC_COUNT; m++) {
+    printf("bins %s:", prof_names[m]);
+    for (uint32_t bin = 0; bin < LVGL_HISTOGRAM_BINS; bin++)
+      printf(" %u", (uint)prof_hist[m].bins[bin]);
+    printf("\n");
+  }
+}
+
+void lvgl_profiler_get(lvgl_profiler_metric_t metric, lvgl_histogram_t &hist) {
+  hist = prof_hist[metric];
+}
+
+void lvgl_profiler_reset() {
+  for (lvgl_histogram_t &h : prof_hist)
+    h = {};
+}
+
+void lvgl_profiler_request_dump() { prof_dump_requested = true; }
+
+static void prof_screen_update(lv_timer_t *timer) {
+  static char text[512];
+  lv_obj_t *label = (lv_obj_t *)lv_timer_get_user_data(timer);
+  prof_format(text, sizeof(text));
+  lv_label_set_text_static(label, text);
+}
+
+void lvgl_profiler_show() {
+  lv_obj_t *prev = lv_screen_active();
+  lv_obj_t *scr = lv_obj_create(nullptr);
+  lv_obj_set_style_bg_color(scr, lv_color_black(), 0);
+  lv_obj_set_style_text_color(scr, lv_color_white(), 0);
+  lv_obj_set_style_pad_all(scr, 8, 0);
+
+  lv_obj_t *label = lv_label_create(scr);
+  lv_obj_set_style_text_font(label, &lv_font_montserrat_12, 0);
+  lv_timer_t *timer = lv_timer_create(prof_screen_update, 1000, label);
+  prof_screen_update(timer);
+
+  // The timer goes with the screen, a tap goes back
+  lv_obj_add_event_cb(
+      scr,
+      [](lv_event_t *e) {
+        lv_timer_delete((lv_timer_t *)lv_event_get_user_data(e));
+      },
+      LV_EVENT_DELETE, timer);
+  lv_obj_add_event_cb(
+      scr,
+      [](lv_event_t *e) {
+        lv_screen_load_anim((lv_obj_t *)lv_event_get_user_data(e),
+                            LV_SCR_LOAD_ANIM_NONE, 0, 0, true);
+      },
+      LV_EVENT_CLICKED, prev);
+  lv_screen_load_anim(scr, LV_SCR_LOAD_ANIM_NONE, 0, 0, false);
+}
+#endif
+
+static uint32_t touch_cal_check(const touch_cal_record_t &rec) {
+  const uint32_t *words = (const uint32_t *)&rec.cal;
+  uint32_t check = rec.magic;
+  for (size_t i = 0; i < sizeof(rec.cal) / 4; i++)
+    check = (check << 5 | check >> 27) ^ words[i];
+  return check;
+}
+
+static bool touch_cal_load() {
+  const touch_cal_record_t *rec =
+      (const touch_cal_record_t *)(XIP_BASE + TOUCH_CAL_OFFSET);
+  if (rec->magic != TOUCH_CAL_MAGIC || rec->check != touch_cal_check(*rec))
+    return false;
+  touch.set_calibration(rec->cal);
+  return true;
+}
+
+static void touch_cal_write(void *page) {
+  flash_range_erase(TOUCH_CAL_OFFSET, FLASH_SECTOR_SIZE);
+  flash_range_program(TOUCH_CAL_OFFSET, (const uint8_t *)page,
+                      FLASH_PAGE_SIZE);
+}
+
+bool lvgl_touch_get_raw(uint16_t &x, uint16_t &y) {
+  if (touch_sampled)
+    return touch.get_sampled_raw(x, y);
+  if (!touch.is_touched())
+    return false;
+  touch.get_raw(x, y);
+  return true;
+}
+
+bool lvgl_touch_calibrate(const uint16_t raw[3][2],
+                          const uint16_t screen[3][2]) {
+  if (!touch.calibrate(raw, screen))
+    return false;
+  static uint8_t page[FLASH_PAGE_SIZE];
+  touch_cal_record_t rec = {TOUCH_CAL_MAGIC, touch.get_calibration(), 0};
+  rec.check = touch_cal_check(rec);
+  memset(page, 0xFF, sizeof(page));
+  memcpy(page, &rec, sizeof(rec));
+  // Core0 is paused meanwhile, it runs multicore_lockout_victim_init()
+  int rc = flash_safe_execute(touch_cal_write, page, 100);
+  if (rc != PICO_OK) {
+    printf("XPT2046: calibration not stored (%d)\n", rc);
+    return true;
+  }
+  touch_calibrated = true;
+  return true;
+}
+
+bool lvgl_touch_is_calibrated() { return touch_calibrated; }
+
+static void touch_cb(lv_indev_t *indev, lv_indev_data_t *data) {
+  uint16_t x, y;
+  bool pressed = touch_sampled ? touch.get_sampled(x, y)
+                               : touch.is_touched() && touch.get_touch(x, y);
+  if (pressed) {
     data->point.x = x;
     data->point.y = y;
     data->state = LV_INDEV_STATE_PRESSED;
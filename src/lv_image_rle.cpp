@@ -0,0 +1,122 @@
+#include "lv_image_rle.h"
+
+#include "src/lvgl_private.h"
+
+// Rows decoded per get_area call, fewer blend calls for 8 * 960 bytes of heap
+#define RLE_ROWS 8
+
+static lv_result_t rle_info(lv_image_decoder_t *decoder,
+                            lv_image_decoder_dsc_t *dsc,
+                            lv_image_header_t *header);
+static lv_result_t rle_open(lv_image_decoder_t *decoder,
+                            lv_image_decoder_dsc_t *dsc);
+static lv_result_t rle_get_area(lv_image_decoder_t *decoder,
+                                lv_image_decoder_dsc_t *dsc,
+                                const lv_area_t *full_area,
+                                lv_area_t *decoded_area);
+static void rle_close(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc);
+
+void lv_image_rle_init() {
+  // Created last so it is asked before the bin decoder
+  lv_image_decoder_t *dec = lv_image_decoder_create();
+  lv_image_decoder_set_info_cb(dec, rle_info);
+  lv_image_decoder_set_open_cb(dec, rle_open);
+  lv_image_decoder_set_get_area_cb(dec, rle_get_area);
+  lv_image_decoder_set_close_cb(dec, rle_close);
+  dec->name = "RLE565";
+}
+
+static lv_result_t rle_info(lv_image_decoder_t *decoder,
+                            lv_image_decoder_dsc_t *dsc,
+                            lv_image_header_t *header) {
+  if (dsc->src_type != LV_IMAGE_SRC_VARIABLE)
+    return LV_RESULT_INVALID;
+  const lv_image_dsc_t *image = (const lv_image_dsc_t *)dsc->src;
+  if (!(image->header.flags & LV_IMAGE_FLAGS_USER1) ||
+      image->header.cf != LV_COLOR_FORMAT_RGB565)
+    return LV_RESULT_INVALID;
+  *header = image->header;
+  return LV_RESULT_OK;
+}
+
+// Nothing decoded up front, LVGL then draws through rle_get_area()
+static lv_result_t rle_open(lv_image_decoder_t *decoder,
+                            lv_image_decoder_dsc_t *dsc) {
+  dsc->decoded = nullptr;
+  return LV_RESULT_OK;
+}
+
+// Writes pixels x1..x2 of one row, the packets before x1 are only skipped
+static void rle_decode_row(const uint8_t *src, int32_t x1, int32_t x2,
+                           uint16_t *out) {
+  int32_t x = 0;
+  while (x <= x2) {
+    uint8_t ctrl = *src++;
+    int32_t len = (ctrl & 0x7F) + 1;
+    int32_t from = LV_MAX(x, x1);
+    int32_t to = LV_MIN(x + len - 1, x2);
+    if (ctrl & 0x80) {
+      uint16_t color = src[0] | (src[1] << 8);
+      for (int32_t i = from; i <= to; i++)
+        *out++ = color;
+      src += 2;
+    } else {
+      if (from <= to)
+        lv_memcpy(out, src + (from - x) * 2, (to - from + 1) * 2);
+      out += LV_MAX(to - from + 1, 0);
+      src += len * 2;
+    }
+    x += len;
+  }
+}
+
+static lv_result_t rle_get_area(lv_image_decoder_t *decoder,
+                                lv_image_decoder_dsc_t *dsc,
+                                const lv_area_t *full_area,
+                                lv_area_t *decoded_area) {
+  const lv_image_dsc_t *image = (const lv_image_dsc_t *)dsc->src;
+  lv_draw_buf_t *decoded = (lv_draw_buf_t *)dsc->decoded;
+  int32_t w_px = lv_area_get_width(full_area);
+
+  if (decoded_area->y1 == LV_COORD_MIN) {
+    *decoded_area = *full_area;
+    decoded_area->y2 = decoded_area->y1 - 1;
+  }
+  decoded_area->y1 = decoded_area->y2 + 1;
+  if (decoded_area->y1 > full_area->y2)
+    return LV_RESULT_INVALID;
+  decoded_area->y2 = LV_MIN(decoded_area->y1 + RLE_ROWS - 1, full_area->y2);
+
+  // Sized to the rows of this call, the buffer only grows on the first one
+  int32_t rows = lv_area_get_height(decoded_area);
+  lv_draw_buf_t *reshaped = lv_draw_buf_reshape(
+      decoded, LV_COLOR_FORMAT_RGB565, w_px, rows, LV_STRIDE_AUTO);
+  if (reshaped == nullptr) {
+    if (decoded)
+      lv_draw_buf_destroy(decoded);
+    reshaped = lv_draw_buf_create(w_px, RLE_ROWS, LV_COLOR_FORMAT_RGB565,
+                                  LV_STRIDE_AUTO);
+    dsc->decoded = reshaped;
+    if (reshaped == nullptr)
+      return LV_RESULT_INVALID;
+    reshaped = lv_draw_buf_reshape(reshaped, LV_COLOR_FORMAT_RGB565, w_px,
+                                   rows, LV_STRIDE_AUTO);
+  }
+  decoded = reshaped;
+  dsc->decoded = decoded;
+
+  for (int32_t y = decoded_area->y1; y <= decoded_area->y2; y++) {
+    uint32_t offset;
+    lv_memcpy(&offset, image->data + y * 4, 4);
+    rle_decode_row(image->data + offset, full_area->x1, full_area->x2,
+                   (uint16_t *)(decoded->data +
+                                (y - decoded_area->y1) * decoded->header.stride));
+  }
+  return LV_RESULT_OK;
+}
+
+static void rle_close(lv_image_decoder_t *decoder,
+                      lv_image_decoder_dsc_t *dsc) {
+  if (dsc->decoded)
+    lv_draw_buf_destroy((lv_draw_buf_t *)dsc->decoded);
+}
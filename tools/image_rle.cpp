@@ -0,0 +1,168 @@
+/**
+ * @file image_rle.cpp
+ * @brief Host-side converter from RGB565 images to the row RLE format read by src/lv_image_rle.cpp
+ *
+ * Takes an LVGL image C file (RGB565, as exported by the LVGL image converter) or raw little endian RGB565 pixels and writes a C
+ * file declaring the same lv_image_dsc_t name, compressed:
+ *   g++ -O2 -std=c++17 tools/image_rle.cpp -o /tmp/image_rle && /tmp/image_rle STP_SPLASH 480 320 splash.c src/STP_SPLASH.c
+ * Format: a uint32_t little endian offset per row from the start of data, then the rows. A row is a list of packets, a control
+ * byte below 0x80 is followed by control + 1 literal pixels, from 0x80 on by one pixel repeated (control & 0x7F) + 1 times.
+ * Packets never cross rows so any row can be decoded on its own.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#define MAX_PACKET 128U
+
+static bool read_file(const char *path, std::string &out) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  char   buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+// The bytes of the first "_map[] = {...};" initializer
+static bool parse_c_array(const std::string &text, std::vector<uint8_t> &bytes) {
+  size_t start = text.find("_map[]");
+  start        = start == std::string::npos ? std::string::npos : text.find('{', start);
+  size_t end   = start == std::string::npos ? std::string::npos : text.find("};", start);
+  if (end == std::string::npos)
+    return false;
+  const char *p = text.c_str() + start + 1;
+  const char *e = text.c_str() + end;
+  while (p < e) {
+    char *next;
+    long  value = strtol(p, &next, 0);
+    if (next == p) {
+      p++;
+      continue;
+    }
+    bytes.push_back((uint8_t) value);
+    p = next;
+  }
+  return true;
+}
+
+static void encode_row(const uint16_t *px, uint32_t width, std::vector<uint8_t> &out) {
+  auto put_pixel = [&out](uint16_t c) {
+    out.push_back(c & 0xFF);
+    out.push_back(c >> 8);
+  };
+  uint32_t x = 0;
+  while (x < width) {
+    uint32_t run = 1;
+    while (x + run < width && run < MAX_PACKET && px[x + run] == px[x])
+      run++;
+    if (run >= 2) {
+      out.push_back(0x80 | (run - 1));
+      put_pixel(px[x]);
+      x += run;
+      continue;
+    }
+    // Literals up to the next pair of equal pixels
+    uint32_t len = 1;
+    while (x + len < width && len < MAX_PACKET && !(x + len + 1 < width && px[x + len + 1] == px[x + len]))
+      len++;
+    out.push_back(len - 1);
+    for (uint32_t i = 0; i < len; i++)
+      put_pixel(px[x + i]);
+    x += len;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 6) {
+    fprintf(stderr, "usage: %s <name> <width> <height> <in.c|in.raw> <out.c>\n", argv[0]);
+    return 1;
+  }
+  const char *name   = argv[1];
+  uint32_t    width  = strtoul(argv[2], nullptr, 0);
+  uint32_t    height = strtoul(argv[3], nullptr, 0);
+
+  std::string input;
+  if (!read_file(argv[4], input)) {
+    fprintf(stderr, "can't read %s\n", argv[4]);
+    return 1;
+  }
+  std::vector<uint8_t> raw;
+  size_t               in_len = strlen(argv[4]);
+  if (in_len > 2 && strcmp(argv[4] + in_len - 2, ".c") == 0) {
+    if (!parse_c_array(input, raw)) {
+      fprintf(stderr, "no _map[] array in %s\n", argv[4]);
+      return 1;
+    }
+  } else {
+    raw.assign(input.begin(), input.end());
+  }
+  if (raw.size() != (size_t) width * height * 2) {
+    fprintf(stderr, "%zu bytes, expected %u for %ux%u RGB565\n", raw.size(), width * height * 2, width, height);
+    return 1;
+  }
+
+  std::vector<uint16_t> px(width * height);
+  for (size_t i = 0; i < px.size(); i++)
+    px[i] = raw[2 * i] | (raw[2 * i + 1] << 8);
+
+  std::vector<uint8_t> data(height * 4);
+  for (uint32_t y = 0; y < height; y++) {
+    uint32_t offset = data.size();
+    memcpy(&data[y * 4], &offset, 4);  // The RP2040 is little endian as well
+    encode_row(&px[y * width], width, data);
+  }
+
+  FILE *f = fopen(argv[5], "w");
+  if (!f) {
+    fprintf(stderr, "can't write %s\n", argv[5]);
+    return 1;
+  }
+  fprintf(f, "// Generated by tools/image_rle.cpp from %ux%u RGB565, %zu bytes raw. Decoded by src/lv_image_rle.cpp.\n\n", width, height,
+          raw.size());
+  // Same preamble as the LVGL image converter
+  fprintf(f,
+          "#ifdef __has_include\n"
+          "    #if __has_include(\"lvgl.h\")\n"
+          "        #ifndef LV_LVGL_H_INCLUDE_SIMPLE\n"
+          "            #define LV_LVGL_H_INCLUDE_SIMPLE\n"
+          "        #endif\n"
+          "    #endif\n"
+          "#endif\n\n"
+          "#if defined(LV_LVGL_H_INCLUDE_SIMPLE)\n"
+          "    #include \"lvgl.h\"\n"
+          "#else\n"
+          "    #include \"lvgl/lvgl.h\"\n"
+          "#endif\n\n"
+          "#ifndef LV_ATTRIBUTE_MEM_ALIGN\n"
+          "#define LV_ATTRIBUTE_MEM_ALIGN\n"
+          "#endif\n\n"
+          "#ifndef LV_ATTRIBUTE_IMAGE_%s\n"
+          "#define LV_ATTRIBUTE_IMAGE_%s\n"
+          "#endif\n\n",
+          name, name);
+  fprintf(f, "const LV_ATTRIBUTE_MEM_ALIGN LV_ATTRIBUTE_LARGE_CONST LV_ATTRIBUTE_IMAGE_%s uint8_t %s_map[] = {\n", name, name);
+  for (size_t i = 0; i < data.size(); i++)
+    fprintf(f, "%s0x%02x,%s", i % 16 == 0 ? "  " : "", data[i], i % 16 == 15 || i + 1 == data.size() ? "\n" : " ");
+  fprintf(f, "};\n\n");
+  fprintf(f, "const lv_image_dsc_t %s = {\n", name);
+  fprintf(f, "  .header.magic = LV_IMAGE_HEADER_MAGIC,\n");
+  fprintf(f, "  .header.cf = LV_COLOR_FORMAT_RGB565,\n");
+  fprintf(f, "  .header.flags = LV_IMAGE_FLAGS_USER1, // Row RLE\n");
+  fprintf(f, "  .header.w = %u,\n", width);
+  fprintf(f, "  .header.h = %u,\n", height);
+  fprintf(f, "  .data_size = %zu,\n", data.size());
+  fprintf(f, "  .data = %s_map,\n", name);
+  fprintf(f, "};\n");
+  fclose(f);
+
+  printf("%s: %zu -> %zu bytes (%.1f%%)\n", name, raw.size(), data.size(), 100.0 * data.size() / raw.size());
+  return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file modbus_capture.cpp
+ * @brief Host-side decoder for ModbusCapture dumps (lib/modbus_master/modbus_capture.h)
+ *
+ * Grab a dump from the board (MODBUS_CAPTURE enabled in src/hmi_pico_stp.cpp), then decode it:
+ *   stty -F /dev/ttyACM0 raw -echo && (timeout 2 cat /dev/ttyACM0 > /tmp/modbus.cap &) && printf C > /dev/ttyACM0 && sleep 2
+ *   g++ -O2 -std=c++17 -Ilib/modbus_master tools/modbus_capture.cpp -o /tmp/modbus_capture && /tmp/modbus_capture /tmp/modbus.cap
+ * Anything before the "MBCP" magic (printf output) is skipped. Prints a readable trace, per slave outcome counts
+ * and a histogram of request to reply latency.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "modbus_capture_reader.h"
+#include "modbus_crc.h"
+
+// Same order as modbus_transaction_status_t
+static const char *status_names[] = {"idle", "pending", "done", "timeout", "invalid crc", "exception"};
+
+#define HISTOGRAM_BUCKET_US 2000U
+#define HISTOGRAM_BUCKETS 50U
+
+struct slave_stats_t {
+  uint32_t              requests                         = 0;
+  uint32_t              replies                          = 0;
+  uint32_t              outcomes[6]                      = {};
+  uint32_t              histogram[HISTOGRAM_BUCKETS + 1] = {};
+  std::vector<uint32_t> latencies_us;
+};
+
+static void print_frame(const record_t &record, uint64_t origin_us) {
+  const char *type = record.type == Capture_TX ? "TX " : record.type == Capture_RX ? "RX " : "EVT";
+  printf("%12.6f %s", (record.time_us - origin_us) / 1e6, type);
+  if (record.type == Capture_Event) {
+    uint8_t status = record.data.empty() ? 0 : record.data[0];
+    printf(" %s\n", status < 6 ? status_names[status] : "?");
+    return;
+  }
+  for (uint8_t byte : record.data) printf(" %02X", byte);
+  if (record.data.size() >= 2) {
+    bool crc_ok = record.data.size() >= 4 && modbus_crc16(record.data.data(), record.data.size()) == 0;
+    printf("   slave 0x%02X fc 0x%02X%s%s", record.data[0], record.data[1] & 0x7F, (record.data[1] & 0x80) ? " exception" : "",
+           crc_ok ? "" : " BAD CRC");
+    if ((record.data[1] & 0x80) && record.data.size() >= 3)
+      printf(" code %u", record.data[2]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s capture.bin [--quiet]\n", argv[0]);
+    return 1;
+  }
+  bool                 quiet = argc > 2 && strcmp(argv[2], "--quiet") == 0;
+  std::vector<uint8_t> file;
+  if (!read_capture_file(argv[1], file))
+    return 1;
+
+  std::vector<record_t> records;
+  uint32_t              overwritten = 0;
+  if (!parse_capture(file, records, overwritten))
+    return 1;
+  printf("%zu records, %u older records overwritten on the device\n", records.size(), overwritten);
+  if (records.empty())
+    return 0;
+
+  std::map<uint8_t, slave_stats_t> slaves;
+  const record_t                  *request = nullptr;
+  bool                             replied = false;
+  for (const record_t &record : records) {
+    if (!quiet)
+      print_frame(record, records.front().time_us);
+
+    if (record.type == Capture_TX && !record.data.empty()) {
+      request = &record;
+      replied = false;
+      slaves[record.data[0]].requests++;
+    } else if (record.type == Capture_RX && request && !replied) {
+      // Latency from the start of the request to the first byte of the reply
+      slave_stats_t &stats   = slaves[request->data[0]];
+      uint32_t       latency = record.time_us - request->time_us;
+      stats.replies++;
+      stats.latencies_us.push_back(latency);
+      stats.histogram[std::min<uint32_t>(latency / HISTOGRAM_BUCKET_US, HISTOGRAM_BUCKETS)]++;
+      replied = true;
+    } else if (record.type == Capture_Event && request && !record.data.empty() && record.data[0] < 6) {
+      slaves[request->data[0]].outcomes[record.data[0]]++;
+    }
+  }
+
+  for (auto &[address, stats] : slaves) {
+    printf("\nslave 0x%02X: %u requests, %u replies, done %u, timeout %u, invalid crc %u, exception %u\n", address, stats.requests, stats.replies,
+           stats.outcomes[2], stats.outcomes[3], stats.outcomes[4], stats.outcomes[5]);
+    if (stats.latencies_us.empty())
+      continue;
+    std::vector<uint32_t> sorted = stats.latencies_us;
+    std::sort(sorted.begin(), sorted.end());
+    printf("  latency min %u us, p50 %u us, p99 %u us, max %u us\n", sorted.front(), sorted[sorted.size() / 2], sorted[(sorted.size() * 99) / 100],
+           sorted.back());
+    uint32_t peak = *std::max_element(stats.histogram, stats.histogram + HISTOGRAM_BUCKETS + 1);
+    for (uint32_t i = 0; i <= HISTOGRAM_BUCKETS; i++) {
+      if (!stats.histogram[i])
+        continue;
+      if (i == HISTOGRAM_BUCKETS)
+        printf("  >=%3u ms %6u ", HISTOGRAM_BUCKETS * HISTOGRAM_BUCKET_US / 1000, stats.histogram[i]);
+      else
+        printf("  %5u ms %6u ", i * HISTOGRAM_BUCKET_US / 1000, stats.histogram[i]);
+      for (uint32_t j = 0; j < stats.histogram[i] * 50 / peak; j++) putchar('#');
+      putchar('\n');
+    }
+  }
+  return 0;
+}
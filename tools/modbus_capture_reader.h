@@ -0,0 +1,80 @@
+#ifndef MODBUS_CAPTURE_READER_H
+#define MODBUS_CAPTURE_READER_H
+
+// Parser for ModbusCapture dumps, shared by tools/modbus_capture.cpp and the replay mode of tools/modbus_sim
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "modbus_capture.h"
+
+struct record_t {
+  modbus_capture_type_t type;
+  uint64_t              time_us;
+  std::vector<uint8_t>  data;
+};
+
+static inline uint32_t read_u32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+static inline bool parse_capture(const std::vector<uint8_t> &file, std::vector<record_t> &records, uint32_t &overwritten) {
+  size_t start = 0;
+  while (start + MODBUS_CAPTURE_HEADER_LEN <= file.size() && memcmp(&file[start], MODBUS_CAPTURE_MAGIC, 4) != 0) start++;
+  if (start + MODBUS_CAPTURE_HEADER_LEN > file.size()) {
+    fprintf(stderr, "No capture header found\n");
+    return false;
+  }
+  const uint8_t *header  = &file[start];
+  uint16_t       version = header[4] | (header[5] << 8);
+  uint32_t       bytes   = read_u32(header + 6);
+  overwritten            = read_u32(header + 10);
+  if (version != MODBUS_CAPTURE_VERSION) {
+    fprintf(stderr, "Unsupported capture version %u\n", version);
+    return false;
+  }
+
+  size_t pos = start + MODBUS_CAPTURE_HEADER_LEN;
+  size_t end = pos + bytes;
+  if (end > file.size()) {
+    fprintf(stderr, "Capture truncated, %zu of %u bytes\n", file.size() - pos, bytes);
+    end = file.size();
+  }
+
+  // Timestamps are 32 bit microseconds, unwrap them into a monotonic 64 bit clock
+  uint64_t epoch = 0;
+  uint32_t last  = 0;
+  while (pos + MODBUS_CAPTURE_RECORD_HEADER_LEN <= end) {
+    uint8_t  len = file[pos + 1];
+    uint32_t now = read_u32(&file[pos + 2]);
+    if (pos + MODBUS_CAPTURE_RECORD_HEADER_LEN + len > end)
+      break;
+    if (!records.empty() && now < last)
+      epoch += 1ULL << 32;
+    last = now;
+
+    record_t record;
+    record.type    = (modbus_capture_type_t) file[pos];
+    record.time_us = epoch + now;
+    record.data.assign(file.begin() + pos + MODBUS_CAPTURE_RECORD_HEADER_LEN, file.begin() + pos + MODBUS_CAPTURE_RECORD_HEADER_LEN + len);
+    records.push_back(record);
+    pos += MODBUS_CAPTURE_RECORD_HEADER_LEN + len;
+  }
+  return true;
+}
+
+// Whole file into memory, false if it cannot be opened
+static inline bool read_capture_file(const char *path, std::vector<uint8_t> &file) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  uint8_t chunk[4096];
+  size_t  n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) file.insert(file.end(), chunk, chunk + n);
+  fclose(f);
+  return true;
+}
+
+#endif
@@ -0,0 +1,372 @@
+/**
+ * @file modbus_bench.cpp
+ * @brief ModbusMaster, ModbusScheduler and the rs485 slave drivers running on the host against a SimBus
+ *
+ *   cmake -S tools/modbus_sim -B /tmp/modbus_sim && cmake --build /tmp/modbus_sim -j && /tmp/modbus_sim/modbus_bench [--seconds 60] [--seed 1]
+ *
+ * First drives every blocking driver call once on a clean bus and checks the decoded values, then runs the
+ * HMI job table under each fault scenario for a stretch of simulated time and prints throughput, latency,
+ * outcomes, the worst gap between PZEM017 samples and the host time spent in the UART interrupt and alarm
+ * callbacks per transaction. Simulated time is deterministic for a given --seed, so engine changes can be compared run to run.
+ *
+ * --replay capture.bin plays a ModbusCapture dump instead: every captured request is sent again and answered
+ * with the bytes the real slave sent back, then decoded by the matching driver.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "../modbus_capture_reader.h"
+#include "esp32.h"
+#include "modbus_master.h"
+#include "modbus_scheduler.h"
+#include "pzem016.h"
+#include "pzem017.h"
+#include "virtual_slaves.h"
+
+// Same wiring and addresses as src/hmi_pico_stp.cpp, plus a PZEM016 to cover its driver and a second profile
+#define PZEM017_ADDRESS 0xF8
+#define PZEM016_ADDRESS 0x02
+#define ESP32_ADDRESS 0x01
+
+// Same order as modbus_transaction_status_t
+static const char *status_names[] = {"idle", "pending", "done", "timeout", "invalid crc", "exception"};
+
+static uint64_t host_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct scenario_t {
+  const char *name;
+  sim_fault_t faults;
+  bool        adaptive_timeout;
+};
+
+struct bench_result_t {
+  uint32_t              transactions   = 0;
+  uint32_t              outcomes[6]    = {};
+  uint32_t              decode_errors  = 0;
+  uint64_t              last_sample_us = 0;
+  uint64_t              max_gap_us     = 0;
+  std::vector<uint32_t> latencies_us;
+};
+
+// Everything one run needs, rebuilt per scenario so no state leaks between them
+struct bench_t {
+  SimBus          bus;
+  VirtualPZEM017  virtual_pzem017 = VirtualPZEM017(PZEM017_ADDRESS);
+  VirtualPZEM016  virtual_pzem016 = VirtualPZEM016(PZEM016_ADDRESS);
+  VirtualESP32    virtual_esp32   = VirtualESP32(ESP32_ADDRESS);
+  ModbusMaster    mbm             = ModbusMaster(18, 17, 16, uart0, 9600, 8, 2, UART_PARITY_NONE);
+  PZEM017         pzem017         = PZEM017(mbm, PZEM017_ADDRESS);
+  PZEM016         pzem016         = PZEM016(mbm, PZEM016_ADDRESS);
+  ESP32           esp32           = ESP32(mbm, ESP32_ADDRESS);
+  ModbusScheduler scheduler       = ModbusScheduler(mbm);
+  bench_result_t  result;
+
+  bench_t(uint32_t seed) : bus(seed) {
+    bus.add_slave(&virtual_pzem017);
+    bus.add_slave(&virtual_pzem016);
+    bus.add_slave(&virtual_esp32);
+    mbm.init();
+
+    // The PZEM016 runs 8N1, the other two share the constructor's 8N2
+    modbus_serial_profile_t pzem016_profile;
+    pzem016_profile.stop_bits = 1;
+    mbm.bind_profile(PZEM016_ADDRESS, mbm.add_profile(pzem016_profile));
+  }
+
+  void set_faults(const sim_fault_t &faults) {
+    virtual_pzem017.faults = faults;
+    virtual_pzem016.faults = faults;
+    virtual_esp32.faults   = faults;
+  }
+};
+
+static bench_t *bench = nullptr;
+
+static void record(modbus_transaction_t &transaction, bool decoded) {
+  bench_result_t &result = bench->result;
+  result.transactions++;
+  result.outcomes[transaction.status]++;
+  if (!decoded && transaction.status == TRANSACTION_DONE)
+    result.decode_errors++;
+  result.latencies_us.push_back(transaction.completed_us - transaction.submitted_us);
+}
+
+static void pzem017_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  modbus_transaction_status_t status = transaction.status;
+  PZEM017::measurement_t      measurement;
+  bool                        ok = bench->pzem017.finish_request_all(transaction, measurement) == PZEM017::No_Error;
+  transaction.status             = status;
+  record(transaction, ok);
+  // The display refreshes from these samples, a long gap is a visible stall
+  if (ok) {
+    uint64_t now = bench->bus.now();
+    if (bench->result.last_sample_us)
+      bench->result.max_gap_us = std::max(bench->result.max_gap_us, now - bench->result.last_sample_us);
+    bench->result.last_sample_us = now;
+  }
+}
+
+static void pzem016_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  // No async decoder for the PZEM016, check the reply shape through the map directly
+  modbus_transaction_status_t status = transaction.status;
+  PZEM016::measurement_t      measurement;
+  bool ok = status == TRANSACTION_DONE && transaction.received == PZEM016::measurement_map_t::response_len &&
+            PZEM016::measurement_map_t::decode(transaction.resp, transaction.received, measurement);
+  record(transaction, ok);
+}
+
+static void esp32_cb(modbus_job_t &job, modbus_transaction_t &transaction) {
+  modbus_transaction_status_t status = transaction.status;
+  ESP32::inputs_t             inputs;
+  bool                        ok = bench->esp32.finish_request_inputs(transaction, inputs) == ESP32::No_Error;
+  transaction.status             = status;
+  record(transaction, ok);
+}
+
+static int check(const char *name, bool ok) {
+  printf("  %-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+static bool near(float a, float b) { return a > b - 0.01f && a < b + 0.01f; }
+
+// Every blocking driver call once on a clean bus
+static int run_driver_checks() {
+  bench_t b(1);
+  bench    = &b;
+  int fail = 0;
+  printf("drivers\n");
+
+  PZEM017::measurement_t m017;
+  fail += check("pzem017 request_all", b.pzem017.request_all(m017) == PZEM017::No_Error && near(m017.voltage, 48.0f) &&
+                                           near(m017.current, 2.5f) && near(m017.power, 120.0f) && near(m017.energy, 1234.0f));
+  fail += check("pzem017 set_high_voltage_alarm",
+                b.pzem017.set_high_voltage_alarm(250.0f) == PZEM017::No_Error && b.virtual_pzem017.parameter[0] == 25000);
+  fail += check("pzem017 reset_energy", b.pzem017.reset_energy() == PZEM017::No_Error && b.virtual_pzem017.energy_resets == 1);
+  fail += check("pzem017 calibrate", b.pzem017.calibrate() == PZEM017::No_Error);
+
+  PZEM016::measurement_t m016;
+  fail += check("pzem016 request_all", b.pzem016.request_all(m016) == PZEM016::No_Error && near(m016.voltage, 230.0f) &&
+                                           near(m016.current, 1.5f) && near(m016.frequency, 50.0f) && near(m016.power_factor, 0.96f));
+  fail += check("pzem016 reset_energy", b.pzem016.reset_energy() == PZEM016::No_Error && b.virtual_pzem016.energy_resets == 1);
+
+  ESP32::inputs_t inputs;
+  fail += check("esp32 request_inputs",
+                b.esp32.request_inputs(inputs) == ESP32::No_Error && near(inputs.temperature, 31.25f) && inputs.sensed_source == Source_AC);
+  fail += check("esp32 set_relay_state", b.esp32.set_relay_state(0x00FF, 1) == ESP32::No_Error && b.virtual_esp32.relay_state[1] == 0x00FF);
+  fail += check("esp32 set_relay_states", b.esp32.set_relay_states(0x1234, 0x5678) == ESP32::No_Error &&
+                                              b.virtual_esp32.relay_state[0] == 0x1234 && b.virtual_esp32.relay_state[1] == 0x5678);
+
+  // Exceptions come back as the slave status, not as a timeout
+  b.virtual_pzem017.faults.exception_rate = 1.0;
+  fail += check("pzem017 exception reply", b.pzem017.request_all(m017) == PZEM017::Slave_Error);
+  b.virtual_pzem017.faults.exception_rate = 0.0;
+  b.virtual_pzem017.faults.silent_rate    = 1.0;
+  fail += check("pzem017 no reply", b.pzem017.request_all(m017) == PZEM017::Timeout);
+
+  bench = nullptr;
+  return fail;
+}
+
+static void run_scenario(const scenario_t &scenario, uint32_t seed, uint32_t seconds) {
+  bench_t b(seed);
+  bench = &b;
+  b.set_faults(scenario.faults);
+  b.mbm.set_adaptive_timeout(scenario.adaptive_timeout, 5000);
+
+  // The HMI job table, plus the PZEM016 once a second
+  const modbus_job_t jobs[] = {
+      {"pzem017", PZEM017_ADDRESS, READ_INPUT_REGISTERS, PZEM017::measurement_map_t::first, PZEM017::measurement_map_t::count,
+       PZEM017::measurement_map_t::response_len, 1000, 250, 0, 250, pzem017_cb},
+      {"esp32", ESP32_ADDRESS, READ_HOLDING_REGISTERS, ESP32::inputs_map_t::first, ESP32::inputs_map_t::count, ESP32::inputs_map_t::response_len,
+       100, 500, 1, 500, esp32_cb},
+      {"pzem016", PZEM016_ADDRESS, READ_INPUT_REGISTERS, PZEM016::measurement_map_t::first, PZEM016::measurement_map_t::count,
+       PZEM016::measurement_map_t::response_len, 1000, 1000, 2, 1000, pzem016_cb},
+  };
+  for (const modbus_job_t &job : jobs) b.scheduler.add_periodic(job);
+  b.scheduler.reset_stats();
+
+  uint64_t end        = b.bus.now() + (uint64_t) seconds * 1000000;
+  uint64_t wall_start = host_ns();
+  while (b.bus.now() < end) {
+    b.scheduler.service();
+    b.bus.step();
+  }
+  uint64_t wall_ns = host_ns() - wall_start;
+
+  bench_result_t &r = b.result;
+  std::sort(r.latencies_us.begin(), r.latencies_us.end());
+  uint32_t p50 = r.latencies_us.empty() ? 0 : r.latencies_us[r.latencies_us.size() / 2];
+  uint32_t p99 = r.latencies_us.empty() ? 0 : r.latencies_us[(r.latencies_us.size() * 99) / 100];
+  printf("%-16s %6u %7.2f %6u %6u %6u %6u %6u %8.1f %8.1f %8.1f %6.1f %8.0f %6.0f\n", scenario.name, r.transactions,
+         r.transactions / (float) seconds, r.outcomes[TRANSACTION_DONE], r.outcomes[TRANSACTION_TIMEOUT], r.outcomes[TRANSACTION_INVALID_CRC],
+         r.outcomes[TRANSACTION_EXCEPTION], r.decode_errors, p50 / 1000.0f, p99 / 1000.0f, r.max_gap_us / 1000.0f, b.scheduler.get_bus_utilization(),
+         r.transactions ? b.bus.stats.handler_ns / (double) r.transactions : 0.0,
+         seconds * 1e9 / std::max<uint64_t>(wall_ns, 1));
+  bench = nullptr;
+}
+
+// Requests and the bursts that answered them, in capture order
+struct replay_exchange_t {
+  std::vector<uint8_t>              request;
+  std::vector<uint32_t>             reply_offsets_us;  // From the request record to the first byte of each burst
+  std::vector<std::vector<uint8_t>> replies;
+  int                               captured_status = -1;
+};
+
+static int run_replay(const char *path) {
+  std::vector<uint8_t> file;
+  if (!read_capture_file(path, file))
+    return 1;
+  std::vector<record_t> records;
+  uint32_t              overwritten = 0;
+  if (!parse_capture(file, records, overwritten))
+    return 1;
+
+  std::vector<replay_exchange_t> exchanges;
+  uint64_t                       request_us = 0;
+  for (const record_t &record : records) {
+    if (record.type == Capture_TX && record.data.size() >= 4) {
+      exchanges.push_back(replay_exchange_t());
+      exchanges.back().request = record.data;
+      request_us               = record.time_us;
+    } else if (!exchanges.empty() && record.type == Capture_RX) {
+      exchanges.back().reply_offsets_us.push_back(record.time_us - request_us);
+      exchanges.back().replies.push_back(record.data);
+    } else if (!exchanges.empty() && record.type == Capture_Event && !record.data.empty()) {
+      exchanges.back().captured_status = record.data[0];
+    }
+  }
+  printf("replaying %zu requests from %s\n", exchanges.size(), path);
+
+  bench_t b(1);
+  bench = &b;
+  // Answer with whatever the real slave sent, at the same offset from the start of the request. A slave may not
+  // answer before t3.5 after the request, which is now, so bursts from a capture at other framing are held back.
+  const replay_exchange_t *current = nullptr;
+  b.bus.on_request                 = [&](const std::vector<uint8_t> &frame) {
+    if (!current)
+      return;
+    uint64_t request_start = b.bus.now() - b.bus.frame_gap_us() - frame.size() * b.bus.char_time_us();
+    for (size_t i = 0; i < current->replies.size(); i++)
+      b.bus.inject(std::max(request_start + current->reply_offsets_us[i] - b.bus.char_time_us(), b.bus.now()), current->replies[i]);
+  };
+
+  uint32_t             mismatches  = 0;
+  uint32_t             outcomes[6] = {};
+  uint8_t             *resp        = b.mbm.get_response_buffer();
+  modbus_transaction_t transaction;
+  for (const replay_exchange_t &exchange : exchanges) {
+    current                             = &exchange;
+    const std::vector<uint8_t> &request = exchange.request;
+    uint8_t                     address = request[0];
+    modbus_pdu_t                pdu;
+    pdu.bytes(&request[1], request.size() - 3);
+
+    // Reads the drivers know are decoded by them, anything else only gets the engine's verdict
+    uint16_t first        = request.size() >= 6 ? (request[2] << 8) | request[3] : 0;
+    uint16_t count        = request.size() >= 8 ? (request[4] << 8) | request[5] : 0;
+    bool     pzem017_read = pdu.function() == READ_INPUT_REGISTERS && first == PZEM017::measurement_map_t::first &&
+                        count == PZEM017::measurement_map_t::count;
+    bool   esp32_read = pdu.function() == READ_HOLDING_REGISTERS && first == ESP32::inputs_map_t::first && count == ESP32::inputs_map_t::count;
+    size_t resp_len   = pzem017_read ? PZEM017::measurement_map_t::response_len : esp32_read ? ESP32::inputs_map_t::response_len : MAX_RESP_SIZE;
+
+    b.mbm.submit(transaction, address, pdu, resp, resp_len, 1000);
+    while (transaction.status == TRANSACTION_PENDING) b.bus.step();
+    modbus_transaction_status_t status = transaction.status;
+    outcomes[status]++;
+
+    printf("%02X %02X -> %-11s", address, pdu.function(), status_names[status]);
+    if (pzem017_read) {
+      PZEM017                meter(b.mbm, address);
+      PZEM017::measurement_t m;
+      PZEM017::status_t      result = meter.finish_request_all(transaction, m);
+      if (result == PZEM017::No_Error)
+        printf(" %.2fV %.2fA %.1fW %.0fWh", m.voltage, m.current, m.power, m.energy);
+      else
+        printf(" %s", ModbusSlave::error_to_string(result));
+    } else if (esp32_read) {
+      ESP32           helper(b.mbm, address);
+      ESP32::inputs_t inputs;
+      ESP32::status_t result = helper.finish_request_inputs(transaction, inputs);
+      if (result == ESP32::No_Error)
+        printf(" %.2fC source %d", inputs.temperature, inputs.sensed_source);
+      else
+        printf(" %s", ModbusSlave::error_to_string(result));
+    }
+    // The device may have seen it differently, e.g. a reply the old engine timed out on
+    if (exchange.captured_status >= 0 && exchange.captured_status != status) {
+      mismatches++;
+      printf("  captured as %s", exchange.captured_status < 6 ? status_names[exchange.captured_status] : "?");
+    }
+    printf("\n");
+    transaction.status = TRANSACTION_IDLE;
+    // Let any late bytes of this exchange drain before the next request
+    b.bus.run_until(b.bus.now() + 50000);
+  }
+  current = nullptr;
+
+  printf("\ndone %u, timeout %u, invalid crc %u, exception %u, %u differ from the capture\n", outcomes[TRANSACTION_DONE],
+         outcomes[TRANSACTION_TIMEOUT], outcomes[TRANSACTION_INVALID_CRC], outcomes[TRANSACTION_EXCEPTION], mismatches);
+  bench = nullptr;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t    seconds = 60;
+  uint32_t    seed    = 1;
+  const char *replay  = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+      seconds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+      seed = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+      replay = argv[++i];
+    else {
+      fprintf(stderr, "usage: %s [--seconds N] [--seed N] [--replay capture.bin]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (replay)
+    return run_replay(replay);
+
+  int failures = run_driver_checks();
+
+  sim_fault_t clean;
+  clean.latency_us     = 8000;
+  clean.jitter_us      = 4000;
+  sim_fault_t slow     = clean;
+  slow.latency_us      = 40000;
+  slow.jitter_us       = 30000;
+  sim_fault_t noisy    = clean;
+  noisy.bit_error_rate = 0.002;
+  sim_fault_t dropping = clean;
+  dropping.drop_rate   = 0.002;
+  sim_fault_t busy     = clean;
+  busy.exception_rate  = 0.05;
+  busy.exception_code  = 6;  // Slave device busy
+  sim_fault_t flaky    = clean;
+  flaky.silent_rate    = 0.02;
+
+  const scenario_t scenarios[] = {
+      {"clean", clean, true},         {"slow", slow, true},       {"bit errors", noisy, true},      {"dropped bytes", dropping, true},
+      {"exceptions", busy, true},     {"no reply", flaky, true},  {"no reply fixed", flaky, false},
+  };
+
+  printf("\n%u s simulated per scenario, seed %u, latency is submit to completion, gap is the worst between PZEM017 samples\n", seconds, seed);
+  printf("%-16s %6s %7s %6s %6s %6s %6s %6s %8s %8s %8s %6s %8s %6s\n", "scenario", "tx", "tx/s", "done", "tmo", "crc", "exc", "decode",
+         "p50 ms", "p99 ms", "gap ms", "bus %", "irq ns", "x real");
+  for (const scenario_t &scenario : scenarios) run_scenario(scenario, seed, seconds);
+
+  if (failures)
+    printf("\n%d driver checks failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef MODBUS_HAL_HOST_H
+#define MODBUS_HAL_HOST_H
+
+// Host side of lib/modbus_master/modbus_hal.h, selected by MODBUS_HAL_HOST. Provides the handful of SDK
+// types the drivers use and routes every call into the SimBus that is currently running (sim_bus.h).
+// Time is virtual: it only moves while the code under test sleeps or idles, so runs are deterministic.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MODBUS_HAL_PIO 0
+
+typedef unsigned int uint;
+typedef int32_t      alarm_id_t;
+
+typedef enum {
+  UART_PARITY_NONE,
+  UART_PARITY_EVEN,
+  UART_PARITY_ODD,
+} uart_parity_t;
+
+typedef struct sim_uart uart_inst_t;
+extern uart_inst_t *const uart0;
+extern uart_inst_t *const uart1;
+
+typedef void (*modbus_hal_irq_handler_t)();
+typedef int64_t (*modbus_hal_alarm_cb_t)(alarm_id_t id, void *user_data);
+
+void    modbus_hal_uart_init(uart_inst_t *uart, uint tx_pin, uint rx_pin, uint baud_rate, uint data_bits, uint stop_bits, uart_parity_t parity);
+void    modbus_hal_uart_set_baudrate(uart_inst_t *uart, uint baud_rate);
+void    modbus_hal_uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity);
+bool    modbus_hal_uart_is_readable(uart_inst_t *uart);
+uint8_t modbus_hal_uart_getc(uart_inst_t *uart);
+bool    modbus_hal_uart_is_writable(uart_inst_t *uart);
+void    modbus_hal_uart_putc(uart_inst_t *uart, uint8_t c);
+void    modbus_hal_uart_write_blocking(uart_inst_t *uart, const uint8_t *data, size_t len);
+bool    modbus_hal_uart_is_busy(uart_inst_t *uart);
+uint    modbus_hal_uart_get_index(uart_inst_t *uart);
+void    modbus_hal_uart_set_irq_enables(uart_inst_t *uart, bool rx, bool tx);
+void    modbus_hal_uart_set_irq_handler(uart_inst_t *uart, modbus_hal_irq_handler_t handler);
+
+void modbus_hal_de_init(uint pin);
+void modbus_hal_de_put(uint pin, bool value);
+
+uint64_t   modbus_hal_time_us_64();
+uint32_t   modbus_hal_time_us_32();
+void       modbus_hal_sleep_us(uint64_t us);
+void       modbus_hal_sleep_ms(uint32_t ms);
+void       modbus_hal_idle();
+alarm_id_t modbus_hal_add_alarm_in_us(uint64_t us, modbus_hal_alarm_cb_t callback, void *user_data);
+void       modbus_hal_cancel_alarm(alarm_id_t id);
+
+#endif
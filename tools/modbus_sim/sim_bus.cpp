@@ -0,0 +1,365 @@
+#include "sim_bus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "modbus_crc.h"
+
+#define IRQ_STORM_LIMIT 10000U  // Back to back interrupts at the same instant before the handler is declared stuck
+
+SimBus *SimBus::current = nullptr;
+
+static uint64_t host_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool VirtualSlave::exception(const uint8_t *pdu, uint8_t code, std::vector<uint8_t> &reply) {
+  reply = {(uint8_t) (pdu[0] | 0x80), code};
+  return true;
+}
+
+bool VirtualSlave::read_registers(const uint8_t *pdu, size_t len, const uint16_t *table, uint16_t count, std::vector<uint8_t> &reply) {
+  if (len != 5)
+    return exception(pdu, 3, reply);
+  uint16_t first    = (pdu[1] << 8) | pdu[2];
+  uint16_t quantity = (pdu[3] << 8) | pdu[4];
+  if (quantity == 0 || quantity > 125)
+    return exception(pdu, 3, reply);
+  if (first + quantity > count)
+    return exception(pdu, 2, reply);
+  reply = {pdu[0], (uint8_t) (quantity * 2)};
+  for (uint16_t i = 0; i < quantity; i++) {
+    reply.push_back(table[first + i] >> 8);
+    reply.push_back(table[first + i] & 0xFF);
+  }
+  return true;
+}
+
+bool VirtualSlave::write_register(const uint8_t *pdu, size_t len, uint16_t *table, uint16_t count, std::vector<uint8_t> &reply) {
+  if (len != 5)
+    return exception(pdu, 3, reply);
+  uint16_t address = (pdu[1] << 8) | pdu[2];
+  if (address >= count)
+    return exception(pdu, 2, reply);
+  table[address] = (pdu[3] << 8) | pdu[4];
+  reply.assign(pdu, pdu + len);
+  return true;
+}
+
+bool VirtualSlave::write_registers(const uint8_t *pdu, size_t len, uint16_t *table, uint16_t count, std::vector<uint8_t> &reply) {
+  if (len < 6)
+    return exception(pdu, 3, reply);
+  uint16_t first    = (pdu[1] << 8) | pdu[2];
+  uint16_t quantity = (pdu[3] << 8) | pdu[4];
+  if (quantity == 0 || quantity > 123 || pdu[5] != quantity * 2 || len != 6U + quantity * 2)
+    return exception(pdu, 3, reply);
+  if (first + quantity > count)
+    return exception(pdu, 2, reply);
+  for (uint16_t i = 0; i < quantity; i++) table[first + i] = (pdu[6 + i * 2] << 8) | pdu[7 + i * 2];
+  reply.assign(pdu, pdu + 5);
+  return true;
+}
+
+SimBus::SimBus(uint32_t seed) : rng(seed), uniform(0.0, 1.0) { current = this; }
+
+SimBus::~SimBus() {
+  if (current == this)
+    current = nullptr;
+}
+
+SimBus::event_key_t SimBus::post(uint64_t at_us, std::function<void()> fn) {
+  event_key_t key = {std::max(at_us, now_us), sequence++};
+  events.emplace(key, std::move(fn));
+  return key;
+}
+
+void SimBus::run_until(uint64_t until_us) {
+  while (!events.empty() && events.begin()->first.first <= until_us) step(until_us - now_us);
+  now_us = std::max(now_us, until_us);
+}
+
+void SimBus::step(uint64_t max_idle_us) {
+  if (events.empty() || events.begin()->first.first > now_us + max_idle_us) {
+    now_us += max_idle_us;
+    return;
+  }
+  auto                  next = events.begin();
+  std::function<void()> fn   = std::move(next->second);
+  now_us                     = next->first.first;
+  events.erase(next);
+  fn();
+}
+
+alarm_id_t SimBus::add_alarm(uint64_t us, modbus_hal_alarm_cb_t callback, void *user_data) {
+  alarm_id_t id = next_alarm++;
+  alarms[id]    = {post(now_us + us, [this, id] { fire_alarm(id); }), callback, user_data};
+  return id;
+}
+
+void SimBus::cancel_alarm(alarm_id_t id) {
+  auto alarm = alarms.find(id);
+  if (alarm == alarms.end())
+    return;
+  events.erase(alarm->second.key);
+  alarms.erase(alarm);
+}
+
+void SimBus::fire_alarm(alarm_id_t id) {
+  auto entry = alarms.find(id);
+  if (entry == alarms.end())
+    return;
+  alarm_t alarm = entry->second;
+  alarms.erase(entry);
+
+  uint64_t start = host_ns();
+  int64_t  again = alarm.callback(id, alarm.user_data);
+  stats.handler_ns += host_ns() - start;
+
+  // Same contract as the SDK: positive reschedules relative to the previous target, negative relative to now
+  if (again > 0)
+    alarms[id] = {post(alarm.key.first + again, [this, id] { fire_alarm(id); }), alarm.callback, alarm.user_data};
+  else if (again < 0)
+    alarms[id] = {post(now_us - again, [this, id] { fire_alarm(id); }), alarm.callback, alarm.user_data};
+}
+
+void SimBus::uart_set_format(uint data_bits, uint stop_bits, uart_parity_t parity) {
+  this->stop_bits = stop_bits;
+  bits_per_char   = 1 + data_bits + (parity == UART_PARITY_NONE ? 0 : 1) + stop_bits;
+}
+
+uint8_t SimBus::uart_getc() {
+  if (rx.empty())
+    return 0;
+  uint8_t c = rx.front();
+  rx.pop_front();
+  return c;
+}
+
+void SimBus::uart_putc(uint8_t c) {
+  // uart_putc_raw spins until the holding register is free
+  while (tx_holding_full) step();
+  tx_holding      = c;
+  tx_holding_full = true;
+  start_shift();
+}
+
+void SimBus::uart_set_irq_enables(bool rx, bool tx) {
+  rx_irq = rx;
+  tx_irq = tx;
+  raise_irq();
+}
+
+void SimBus::uart_set_irq_handler(modbus_hal_irq_handler_t handler) { this->handler = handler; }
+
+void SimBus::de_init(uint pin) {
+  de_pin = pin;
+  de     = false;
+}
+
+void SimBus::de_put(uint pin, bool value) {
+  if (pin == de_pin)
+    de = value;
+}
+
+void SimBus::start_shift() {
+  if (tx_shifting || !tx_holding_full)
+    return;
+  uint8_t c       = tx_holding;
+  tx_holding_full = false;
+  tx_shifting     = true;
+  stats.busy_us += char_time_us();
+
+  // The byte is intact if DE is still high after the last data bit. Losing DE during the stop bits is harmless,
+  // the bus bias holds the idle line at the same level.
+  uint32_t stop_us = (stop_bits * 1000000 + baud_rate - 1) / baud_rate;
+  post(now_us + char_time_us() - stop_us, [this, c, stop_us] {
+    bool driven = de;
+    post(now_us + stop_us, [this, c, driven] {
+      tx_shifting = false;
+      if (driven)
+        master_byte(c);
+      else
+        stats.sent_without_de++;
+      start_shift();
+      raise_irq();
+    });
+  });
+  raise_irq();
+}
+
+void SimBus::raise_irq() {
+  if (irq_pending || !handler)
+    return;
+  if ((rx_irq && !rx.empty()) || (tx_irq && !tx_holding_full)) {
+    irq_pending = true;
+    post(now_us, [this] { service_irq(); });
+  }
+}
+
+void SimBus::service_irq() {
+  static uint64_t storm_at = ~0ULL;
+  static uint     storm    = 0;
+  irq_pending              = false;
+  if (!((rx_irq && !rx.empty()) || (tx_irq && !tx_holding_full)))
+    return;
+
+  storm    = storm_at == now_us ? storm + 1 : 0;
+  storm_at = now_us;
+  if (storm > IRQ_STORM_LIMIT) {
+    fprintf(stderr, "UART interrupt stuck at %llu us, the handler never clears its source\n", (unsigned long long) now_us);
+    exit(1);
+  }
+
+  uint64_t start = host_ns();
+  handler();
+  stats.handler_ns += host_ns() - start;
+  // Level triggered, fires again while the condition holds
+  raise_irq();
+}
+
+void SimBus::deliver(uint8_t c) {
+  // RE is the inverse of DE on the transceiver, nothing is received while the master drives the line
+  if (de) {
+    stats.lost_to_de++;
+    return;
+  }
+  if (!rx.empty()) {
+    stats.overruns++;
+    return;
+  }
+  rx.push_back(c);
+  raise_irq();
+}
+
+void SimBus::inject(uint64_t at_us, const std::vector<uint8_t> &bytes) {
+  for (size_t i = 0; i < bytes.size(); i++) {
+    uint8_t c = bytes[i];
+    stats.busy_us += char_time_us();
+    post(at_us + (i + 1) * char_time_us(), [this, c] { deliver(c); });
+  }
+}
+
+void SimBus::master_byte(uint8_t c) {
+  request.push_back(c);
+  // The request ends after t3.5 of silence
+  if (request_end_pending)
+    events.erase(request_end);
+  request_end         = post(now_us + frame_gap_us(), [this] { dispatch(); });
+  request_end_pending = true;
+}
+
+void SimBus::dispatch() {
+  request_end_pending        = false;
+  std::vector<uint8_t> frame = std::move(request);
+  request.clear();
+  stats.requests++;
+
+  if (on_request) {
+    on_request(frame);
+    return;
+  }
+  if (frame.size() < 4 || modbus_crc16(frame.data(), frame.size()) != 0) {
+    stats.bad_requests++;
+    return;
+  }
+
+  bool handled = false;
+  for (VirtualSlave *slave : slaves) {
+    if (slave->address != frame[0] && frame[0] != 0)
+      continue;
+    if (slave->baud_rate && slave->baud_rate != baud_rate)
+      continue;
+    handled = true;
+    slave->requests++;
+
+    std::vector<uint8_t> pdu;
+    if (uniform(rng) < slave->faults.silent_rate) {
+      stats.silent++;
+      continue;
+    }
+    if (uniform(rng) < slave->faults.exception_rate) {
+      stats.exceptions++;
+      pdu = {(uint8_t) (frame[1] | 0x80), slave->faults.exception_code};
+    } else if (!slave->handle(&frame[1], frame.size() - 3, pdu)) {
+      stats.silent++;
+      continue;
+    }
+    // Broadcasts are never answered
+    if (frame[0] != 0)
+      reply(*slave, pdu);
+  }
+  if (!handled)
+    stats.bad_requests++;
+}
+
+void SimBus::reply(VirtualSlave &slave, const std::vector<uint8_t> &pdu) {
+  std::vector<uint8_t> frame = {slave.address};
+  frame.insert(frame.end(), pdu.begin(), pdu.end());
+  uint16_t crc = modbus_crc16(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  stats.replies++;
+
+  uint64_t start = now_us + slave.faults.latency_us + (uint64_t) (uniform(rng) * slave.faults.jitter_us);
+  for (size_t i = 0; i < frame.size(); i++) {
+    uint8_t c = frame[i];
+    stats.busy_us += char_time_us();
+    // A dropped byte leaves its slot silent, shorter than t3.5 so the master sees a short frame
+    if (uniform(rng) < slave.faults.drop_rate) {
+      stats.dropped_bytes++;
+      continue;
+    }
+    if (uniform(rng) < slave.faults.bit_error_rate) {
+      stats.bit_errors++;
+      c ^= 1 << (rng() % 8);
+    }
+    post(start + (i + 1) * char_time_us(), [this, c] { deliver(c); });
+  }
+}
+
+// modbus_hal_host.h, everything goes to the current bus
+
+struct sim_uart {
+  uint index;
+};
+
+static sim_uart    sim_uarts[2] = {{0}, {1}};
+uart_inst_t *const uart0        = &sim_uarts[0];
+uart_inst_t *const uart1        = &sim_uarts[1];
+
+void modbus_hal_uart_init(uart_inst_t *uart, uint tx_pin, uint rx_pin, uint baud_rate, uint data_bits, uint stop_bits, uart_parity_t parity) {
+  SimBus::current->uart_set_baudrate(baud_rate);
+  SimBus::current->uart_set_format(data_bits, stop_bits, parity);
+}
+
+void modbus_hal_uart_set_baudrate(uart_inst_t *uart, uint baud_rate) { SimBus::current->uart_set_baudrate(baud_rate); }
+void modbus_hal_uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity) {
+  SimBus::current->uart_set_format(data_bits, stop_bits, parity);
+}
+bool    modbus_hal_uart_is_readable(uart_inst_t *uart) { return SimBus::current->uart_is_readable(); }
+uint8_t modbus_hal_uart_getc(uart_inst_t *uart) { return SimBus::current->uart_getc(); }
+bool    modbus_hal_uart_is_writable(uart_inst_t *uart) { return SimBus::current->uart_is_writable(); }
+void    modbus_hal_uart_putc(uart_inst_t *uart, uint8_t c) { SimBus::current->uart_putc(c); }
+void    modbus_hal_uart_write_blocking(uart_inst_t *uart, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) SimBus::current->uart_putc(data[i]);
+}
+bool modbus_hal_uart_is_busy(uart_inst_t *uart) { return SimBus::current->uart_is_busy(); }
+uint modbus_hal_uart_get_index(uart_inst_t *uart) { return uart->index; }
+void modbus_hal_uart_set_irq_enables(uart_inst_t *uart, bool rx, bool tx) { SimBus::current->uart_set_irq_enables(rx, tx); }
+void modbus_hal_uart_set_irq_handler(uart_inst_t *uart, modbus_hal_irq_handler_t handler) { SimBus::current->uart_set_irq_handler(handler); }
+
+void modbus_hal_de_init(uint pin) { SimBus::current->de_init(pin); }
+void modbus_hal_de_put(uint pin, bool value) { SimBus::current->de_put(pin, value); }
+
+uint64_t   modbus_hal_time_us_64() { return SimBus::current->now(); }
+uint32_t   modbus_hal_time_us_32() { return (uint32_t) SimBus::current->now(); }
+void       modbus_hal_sleep_us(uint64_t us) { SimBus::current->run_until(SimBus::current->now() + us); }
+void       modbus_hal_sleep_ms(uint32_t ms) { modbus_hal_sleep_us((uint64_t) ms * 1000); }
+void       modbus_hal_idle() { SimBus::current->step(); }
+alarm_id_t modbus_hal_add_alarm_in_us(uint64_t us, modbus_hal_alarm_cb_t callback, void *user_data) {
+  return SimBus::current->add_alarm(us, callback, user_data);
+}
+void modbus_hal_cancel_alarm(alarm_id_t id) { SimBus::current->cancel_alarm(id); }
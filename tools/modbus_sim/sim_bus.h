@@ -0,0 +1,170 @@
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "modbus_hal_host.h"
+
+/**
+ * @brief Faults a virtual slave injects into its replies
+ * Probabilities are drawn per request (exception_rate, silent_rate) or per reply byte (bit_error_rate, drop_rate).
+ */
+struct sim_fault_t {
+  uint32_t latency_us     = 8000;  // End of the request to the first reply byte
+  uint32_t jitter_us      = 0;     // Uniform extra latency
+  double   bit_error_rate = 0;     // One random bit flipped
+  double   drop_rate      = 0;     // Byte never reaches the master
+  double   exception_rate = 0;     // Answer with exception_code instead of the normal reply
+  double   silent_rate    = 0;     // No reply at all
+  uint8_t  exception_code = 4;
+};
+
+class VirtualSlave {
+ public:
+  VirtualSlave(uint8_t address) : address(address) {}
+  virtual ~VirtualSlave() {}
+
+  /**
+   * @brief Answer one intact request
+   * @param pdu Request without address and CRC
+   * @param reply Response PDU to fill, the bus adds address and CRC
+   * @return false to stay silent
+   */
+  virtual bool handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) = 0;
+
+  uint8_t     address;
+  sim_fault_t faults;
+  uint        baud_rate = 0;  // A request sent at another baud rate is noise to this slave, 0 accepts any
+  uint32_t    requests  = 0;
+
+ protected:
+  static bool exception(const uint8_t *pdu, uint8_t code, std::vector<uint8_t> &reply);
+  // Standard 0x03/0x04, 0x06 and 0x10 handling over a register table, with the matching exceptions
+  static bool read_registers(const uint8_t *pdu, size_t len, const uint16_t *table, uint16_t count, std::vector<uint8_t> &reply);
+  static bool write_register(const uint8_t *pdu, size_t len, uint16_t *table, uint16_t count, std::vector<uint8_t> &reply);
+  static bool write_registers(const uint8_t *pdu, size_t len, uint16_t *table, uint16_t count, std::vector<uint8_t> &reply);
+};
+
+struct sim_bus_stats_t {
+  uint32_t requests        = 0;
+  uint32_t bad_requests    = 0;  // CRC error or no slave at the address
+  uint32_t replies         = 0;
+  uint32_t exceptions      = 0;
+  uint32_t silent          = 0;
+  uint32_t bit_errors      = 0;
+  uint32_t dropped_bytes   = 0;
+  uint32_t lost_to_de      = 0;  // Reply bytes arriving while the master still drove DE
+  uint32_t sent_without_de = 0;  // Master bytes whose data bits went out with DE released
+  uint32_t overruns        = 0;
+  uint64_t busy_us         = 0;  // Time the line carried a character
+  uint64_t handler_ns      = 0;  // Host time spent in the UART IRQ handler and alarm callbacks
+};
+
+/**
+ * @brief Discrete event model of one RS-485 segment: the master UART, its DE pin and virtual slaves
+ * Implements modbus_hal_host.h for whichever bus is current. Characters take their real time on the line,
+ * the UART raises its interrupt like the PL011 with the FIFO disabled (one byte deep each way) and a request
+ * is answered t3.5 after its last byte plus the slave latency.
+ */
+class SimBus {
+ public:
+  SimBus(uint32_t seed = 1);
+  ~SimBus();
+
+  void add_slave(VirtualSlave *slave) { slaves.push_back(slave); }
+
+  uint64_t now() { return now_us; }
+  uint32_t char_time_us() { return (bits_per_char * 1000000 + baud_rate - 1) / baud_rate; }
+  uint32_t frame_gap_us() { return baud_rate > 19200 ? 1750 : (char_time_us() * 7 + 1) / 2; }
+  // Run events until time reaches until_us
+  void run_until(uint64_t until_us);
+  // Run the next event, or move time forward by at most max_idle_us when nothing is pending
+  void step(uint64_t max_idle_us = 100);
+
+  /**
+   * @brief Play raw bytes to the master as if a slave sent them
+   * @param at_us Time of the first start bit, later bytes follow back to back
+   */
+  void inject(uint64_t at_us, const std::vector<uint8_t> &bytes);
+
+  // Called with every complete request frame, replaces the virtual slaves, e.g. to replay a capture
+  std::function<void(const std::vector<uint8_t> &frame)> on_request;
+
+  sim_bus_stats_t stats;
+
+  // Bus the modbus_hal_* functions talk to, the most recently constructed one
+  static SimBus *current;
+
+  // Backing for modbus_hal_host.h
+  void       uart_set_baudrate(uint baud_rate) { this->baud_rate = baud_rate; }
+  void       uart_set_format(uint data_bits, uint stop_bits, uart_parity_t parity);
+  bool       uart_is_readable() { return !rx.empty(); }
+  uint8_t    uart_getc();
+  bool       uart_is_writable() { return !tx_holding_full; }
+  void       uart_putc(uint8_t c);
+  bool       uart_is_busy() { return tx_holding_full || tx_shifting; }
+  void       uart_set_irq_enables(bool rx, bool tx);
+  void       uart_set_irq_handler(modbus_hal_irq_handler_t handler);
+  void       de_init(uint pin);
+  void       de_put(uint pin, bool value);
+  alarm_id_t add_alarm(uint64_t us, modbus_hal_alarm_cb_t callback, void *user_data);
+  void       cancel_alarm(alarm_id_t id);
+
+ private:
+  typedef std::pair<uint64_t, uint64_t> event_key_t;  // Time, sequence
+
+  struct alarm_t {
+    event_key_t           key;
+    modbus_hal_alarm_cb_t callback;
+    void                 *user_data;
+  };
+
+  uint64_t                                     now_us     = 0;
+  uint64_t                                     sequence   = 0;
+  alarm_id_t                                   next_alarm = 1;
+  std::map<event_key_t, std::function<void()>> events;
+  std::map<alarm_id_t, alarm_t>                alarms;
+
+  std::mt19937                     rng;
+  std::uniform_real_distribution<> uniform;
+  std::vector<VirtualSlave *>      slaves;
+
+  // Master UART
+  uint                     baud_rate       = 9600;
+  uint                     bits_per_char   = 10;
+  uint                     stop_bits       = 1;
+  uint                     de_pin          = ~0U;
+  bool                     de              = false;
+  bool                     rx_irq          = false;
+  bool                     tx_irq          = false;
+  bool                     irq_pending     = false;
+  modbus_hal_irq_handler_t handler         = nullptr;
+  bool                     tx_holding_full = false;
+  uint8_t                  tx_holding      = 0;
+  bool                     tx_shifting     = false;
+  std::deque<uint8_t>      rx;
+
+  // Request being collected from the line
+  std::vector<uint8_t> request;
+  bool                 request_end_pending = false;
+  event_key_t          request_end;
+
+  event_key_t post(uint64_t at_us, std::function<void()> fn);
+  void        fire_alarm(alarm_id_t id);
+
+  void start_shift();
+  void raise_irq();
+  void service_irq();
+  void deliver(uint8_t c);
+  void master_byte(uint8_t c);
+  void dispatch();
+  void reply(VirtualSlave &slave, const std::vector<uint8_t> &pdu);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "virtual_slaves.h"
+
+#include <algorithm>
+
+VirtualPZEM017::VirtualPZEM017(uint8_t address) : VirtualSlave(address) {
+  // 48.00V, 2.50A, 120.0W, 1234Wh, no alarm
+  uint16_t defaults[8] = {4800, 250, 1200, 0, 1234, 0, 0, 0};
+  std::copy(defaults, defaults + 8, input);
+  parameter[0] = 30000;
+  parameter[1] = 700;
+  parameter[2] = address;
+  parameter[3] = 0;
+}
+
+bool VirtualPZEM017::handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) {
+  switch (pdu[0]) {
+  case 0x04:
+    return read_registers(pdu, len, input, 8, reply);
+  case 0x03:
+    return read_registers(pdu, len, parameter, 4, reply);
+  case 0x06:
+    return write_register(pdu, len, parameter, 4, reply);
+  case 0x42:
+    input[4] = input[5] = 0;
+    energy_resets++;
+    reply = {0x42};
+    return true;
+  case 0x41:
+    // Only the fixed password is accepted
+    if (len != 3 || pdu[1] != 0x37 || pdu[2] != 0x21)
+      return exception(pdu, 3, reply);
+    reply.assign(pdu, pdu + len);
+    return true;
+  default:
+    return exception(pdu, 1, reply);
+  }
+}
+
+VirtualPZEM016::VirtualPZEM016(uint8_t address) : VirtualSlave(address) {
+  // 230.0V, 1.500A, 330.0W, 5678Wh, 50.0Hz, PF 0.96, no alarm
+  uint16_t defaults[10] = {2300, 1500, 0, 3300, 0, 5678, 0, 500, 96, 0};
+  std::copy(defaults, defaults + 10, input);
+  parameter[0] = 0;
+  parameter[1] = 2300;
+  parameter[2] = address;
+}
+
+bool VirtualPZEM016::handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) {
+  switch (pdu[0]) {
+  case 0x04:
+    return read_registers(pdu, len, input, 10, reply);
+  case 0x03:
+    return read_registers(pdu, len, parameter, 3, reply);
+  case 0x06:
+    return write_register(pdu, len, parameter, 3, reply);
+  case 0x42:
+    input[5] = input[6] = 0;
+    energy_resets++;
+    reply = {0x42};
+    return true;
+  default:
+    return exception(pdu, 1, reply);
+  }
+}
+
+VirtualESP32::VirtualESP32(uint8_t address) : VirtualSlave(address) {
+  // 31.25 C, AC source, no SSID or scan pending
+  uint16_t defaults[4] = {125, 1, 0, 0};
+  std::copy(defaults, defaults + 4, input);
+}
+
+bool VirtualESP32::handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) {
+  switch (pdu[0]) {
+  case 0x03:
+    return read_registers(pdu, len, input, 4, reply);
+  case 0x06:
+    return write_register(pdu, len, relay_state, 2, reply);
+  case 0x10:
+    return write_registers(pdu, len, relay_state, 2, reply);
+  default:
+    return exception(pdu, 1, reply);
+  }
+}
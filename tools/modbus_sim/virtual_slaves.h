@@ -0,0 +1,44 @@
+#ifndef VIRTUAL_SLAVES_H
+#define VIRTUAL_SLAVES_H
+
+#include "sim_bus.h"
+
+// Register level models of the devices on the HMI bus, answering like the datasheets describe.
+// Measurements are plain register values, set them directly to make the drivers see something else.
+
+// PZEM-017 DC meter: 8 input registers, 4 parameters, reset energy (0x42) and calibration (0x41)
+class VirtualPZEM017 : public VirtualSlave {
+ public:
+  VirtualPZEM017(uint8_t address);
+  bool handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) override;
+
+  // Voltage 0.01V, current 0.01A, power 0.1W and energy 1Wh (both low word first), alarm status
+  uint16_t input[8];
+  // High/low voltage alarm 0.01V, address, current range
+  uint16_t parameter[4];
+  uint32_t energy_resets = 0;
+};
+
+// PZEM-016 AC meter: 10 input registers, power alarm and address parameters, reset energy (0x42)
+class VirtualPZEM016 : public VirtualSlave {
+ public:
+  VirtualPZEM016(uint8_t address);
+  bool handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) override;
+
+  // Voltage 0.1V, current 0.001A, power 0.1W, energy 1Wh (32 bit low word first), frequency 0.1Hz, PF 0.01, alarm
+  uint16_t input[10];
+  uint16_t parameter[3];
+  uint32_t energy_resets = 0;
+};
+
+// ESP32 helper: reads return temperature (0.25 C) and sensed source, writes land in the two relay registers
+class VirtualESP32 : public VirtualSlave {
+ public:
+  VirtualESP32(uint8_t address);
+  bool handle(const uint8_t *pdu, size_t len, std::vector<uint8_t> &reply) override;
+
+  uint16_t input[4];
+  uint16_t relay_state[2] = {0, 0};
+};
+
+#endif